@@ -1,31 +1,430 @@
 #include <xc.h>                       
-// Incluye los registros y definiciones del compilador XC8 especficos del PIC18F4550.
+// Incluye los registros y definiciones del compilador XC8 específicos del PIC18F4550.
 // Necesario para poder usar registros como TRISx, LATx, TMR0, etc.
 
 #define _XTAL_FREQ 1000000       
-// Define la frecuencia del oscilador del PIC (1 MHz).
-// Es obligatorio para que las funciones __delay_ms() y __delay_us() generen el tiempo correcto.
+// Frecuencia del oscilador en el perfil lento (1 MHz), que es con la que arranca el PIC.
+// __delay_ms() y __delay_us() se calculan con este valor en tiempo de compilación; en
+// perfiles más rápidos los retardos se repiten multiplicadorReloj veces (RETARDO_1MS).
+
+// ================= PERFILES DE RELOJ =================
+
+#define PERFIL_LENTO       0
+// INTOSC a 1 MHz (Fcy = 250 kHz): bienvenida, menús, espera y suspensión.
+#define PERFIL_RAPIDO      1
+// INTOSC a 8 MHz (Fcy = 2 MHz): mientras hay un lote en conteo.
+#define TOTAL_PERFILES     2
+#define SIN_PERFIL_PEDIDO  0xFF
+// Valor de perfilPedido cuando no hay un cambio de perfil esperando a la ISR.
+
+unsigned char multiplicadorReloj = 1;
+// Frecuencia del perfil activo dividida por _XTAL_FREQ (1 u 8).
+// Va antes de incluir la librería porque ella también espera con RETARDO_1MS().
+volatile unsigned char perfilReloj;
+// Perfil activo (PERFIL_LENTO o PERFIL_RAPIDO). También lo usa TRAZA() dentro de la librería.
+volatile unsigned char perfilPedido = SIN_PERFIL_PEDIDO;
+// Perfil que FijaPerfilReloj() dejó para que la ISR lo aplique en el próximo tick.
+
+#define RETARDO_1MS()   do{ for(unsigned char k = multiplicadorReloj; k != 0; k--) __delay_ms(1); }while(0)
+// 1 ms con cualquier perfil: __delay_ms(1) dura 250 ciclos y a 8 MHz se repite 8 veces.
+#define ESPERA_TICK_LCD()   RETARDO_1MS()
+// La librería del LCD usa esta espera cuando vacía la cola sin interrupciones.
+
+// ================= MEDICIÓN DE CICLOS Y TRAZA (BANCO DE PRUEBAS) =================
+
+//#define MEDIR_CICLOS
+// Descomentar (o agregar MEDIR_CICLOS en las macros del proyecto) para medir en
+// ciclos de instrucción las rutas críticas del programa. Timer1 corre libre a Fosc/4
+// sin prescaler y cada ruta guarda su última duración y la peor en ciclosUltimo[] y
+// ciclosMax[], una fila por ruta (índices MED_*). En tests/host, "make banco" las
+// vuelca a banco.csv con el tamaño del programa y falla si alguna crece respecto a
+// banco_referencia.csv ("make banco_pic" hace lo mismo con el .hex en gpsim).
+// Sin MEDIR_CICLOS los macros quedan vacíos y no generan código.
+// Va antes de incluir la librería del LCD porque ella también usa los macros.
+
+//#define TRAZA_EVENTOS
+// Descomentar (o agregar TRAZA_EVENTOS en las macros del proyecto) para registrar en
+// una cola circular de RAM cada entrada y salida de las mismas rutas, con la marca de
+// tiempo de Timer3. La tecla LUZ sostenida vuelca la traza por la telemetría
+// (TRAMA_TRAZA) y tools/TrazaAVCD.c la convierte en un archivo VCD para GTKWave.
+// Se puede activar junto con MEDIR_CICLOS o por separado.
+
+#if defined(MEDIR_CICLOS) || defined(TRAZA_EVENTOS)
+#define MED_ISR              0   // ISR completa
+#define MED_ENVIA_DATO       1   // EnviaDato (un byte al LCD)
+#define MED_ESCRIBE_N8       2   // EscribeFB_n8 / EscribeLCD_n8
+#define MED_MENSAJE          3   // MensajeFB / MensajeLCD_Var / DibujaPantalla
+#define MED_REFRESCA         4   // RefrescaLCD
+#define MED_CONFIG_PREGUNTA  5   // ConfigPregunta
+#define MED_CICLO_PRINCIPAL  6   // una vuelta del bucle principal
+#define MED_SUMA_PIEZAS      7   // bloque que suma las piezas nuevas
+#define MED_RETARDO          8   // RETARDO_MS (esperas bloqueantes)
+#define MED_CARRILES         9   // MuestreaCarriles (un muestreo de los 8 carriles)
+#define MED_TOTAL            10
+#endif
+
+#ifdef MEDIR_CICLOS
+unsigned int ciclosInicio[MED_TOTAL];
+unsigned int ciclosUltimo[MED_TOTAL];
+unsigned int ciclosMax[MED_TOTAL];
+
+#define MIDE_INICIO(id)     ciclosInicio[id] = TMR1
+#define MIDE_FIN(id)        do{ ciclosUltimo[id] = TMR1 - ciclosInicio[id]; \
+                                if(ciclosUltimo[id] > ciclosMax[id]) ciclosMax[id] = ciclosUltimo[id]; }while(0)
+#else
+#define MIDE_INICIO(id)
+#define MIDE_FIN(id)
+#endif
+
+#ifdef TRAZA_EVENTOS
+#define TAM_TRAZA           64
+// Eventos guardados (potencia de 2). Al llenarse se sobrescriben los más viejos.
+#define TRAZA_SALE          0x80
+// Bit 7 del evento: salida de la ruta (sin él, entrada).
+#define TRAZA_RAPIDO        0x40
+// Bit 6 del evento: se registró en PERFIL_RAPIDO (tick de Timer3 = 4 us; si no, 32 us).
+
+unsigned char trazaEvento[TAM_TRAZA];
+// MED_* | TRAZA_SALE | TRAZA_RAPIDO.
+unsigned int trazaTiempo[TAM_TRAZA];
+// TMR3 al registrar el evento.
+unsigned char trazaIndice;
+// Próxima posición a escribir.
+unsigned char trazaLlena;
+// 1 cuando trazaIndice ya dio la vuelta (el evento más viejo está en trazaIndice).
+unsigned char trazaCongelada;
+// 1 mientras se vuelca: los eventos nuevos no pisan los que se están enviando.
+
+#define TRAZA(ev)   do{ if(trazaCongelada == 0){ unsigned char gieTraza = GIE; GIE = 0;          \
+                            trazaEvento[trazaIndice] = (ev) | (perfilReloj ? TRAZA_RAPIDO : 0);    \
+                            trazaTiempo[trazaIndice] = TMR3;                                       \
+                            trazaIndice = (trazaIndice + 1) & (TAM_TRAZA - 1);                     \
+                            if(trazaIndice == 0) trazaLlena = 1;                                   \
+                            GIE = gieTraza; } }while(0)
+// GIE se apaga solo si estaba encendido: dentro de la ISR queda igual.
+#else
+#define TRAZA(ev)
+#endif
+
+#define INICIO_CICLOS(id)   do{ MIDE_INICIO(id); TRAZA(id); }while(0)
+#define FIN_CICLOS(id)      do{ MIDE_FIN(id); TRAZA((id) | TRAZA_SALE); }while(0)
+// Sin MEDIR_CICLOS ni TRAZA_EVENTOS quedan como do{}while(0) y no generan código.
 
 #include "LibLCDXC8_3.h"         
-// Incluye la librera propia para manejar el LCD.
-// Aqu estn las funciones: ConfiguraLCD, InicializaLCD, EscribeLCD_c, MensajeLCD_Var,
+// Incluye la librería propia para manejar el LCD (versión con cola, no bloqueante).
+// Las escrituras se encolan y la ISR de Timer2 las envía al LCD, un byte por milisegundo.
+// Aquí están las funciones: ConfiguraLCD, InicializaLCD, EscribeLCD_c, MensajeLCD_Var,
 // DireccionaLCD, CrearCaracter, BorraLCD, DesplazaPantallaD, OcultarCursor, MostrarCursor, etc.
 
-// ================= CONFIGURACIN DE BITS DE CONFIGURACIN =================
+// ================= CONFIGURACIÓN DE BITS DE CONFIGURACIÓN =================
 
 #pragma config FOSC=INTOSC_EC    
 // Configura la fuente de reloj del PIC.
-// INTOSC_EC: usa el oscilador interno del PIC y permite seal en OSC2 para otros fines.
-// A nivel prctico aqu se esta usando el oscilador interno a 1 MHz (coherente con _XTAL_FREQ).
+// INTOSC_EC: usa el oscilador interno del PIC y permite señal en OSC2 para otros fines.
+// A nivel práctico aquí se esta usando el oscilador interno a 1 MHz (coherente con _XTAL_FREQ).
 
 #pragma config WDT=OFF           
-// Desactiva el Watchdog Timer (perro guardin).
+// Desactiva el Watchdog Timer (perro guardián).
 // Evita que el PIC se reinicie solo si el programa se cuelga.
 
-#pragma config LVP=OFF           
-// Desactiva la programacin en bajo voltaje.
+#pragma config LVP=OFF
+// Desactiva la programación en bajo voltaje.
 // Libera el pin de LVP para uso normal y evita problemas si ese pin queda flotando.
 
+#pragma config CCP2MX=ON
+// Multiplexa la entrada del módulo CCP2 sobre RC1.
+// Así el sensor de piezas (RC1) queda conectado directamente al módulo de captura.
+
+// ================= CONSTANTES DEL MOTOR DE CONTEO =================
+
+#define TICKS_TIMER3(us, fcy)   ((unsigned int)((unsigned long)(us) * ((fcy) / 8) / 1000000UL))
+// Convierte microsegundos a ticks de Timer3 (prescaler 1:8) para una Fcy dada.
+
+#define PIEZA_MIN_US       5000
+// Separación mínima entre dos flancos de RC1 para aceptarlos como piezas distintas (5 ms).
+// La ISR la compara en ticks de Timer3 (piezaMinTicks), que dependen del perfil de reloj.
+// Filtra rebotes del pulsador sin limitar líneas rápidas (50 Hz = 20 ms entre piezas).
+
+#define BEEP_DECENA_MS     300
+// Duración del beep de decena, medida con el reloj de milisegundos (igual en todo perfil).
+
+// ================= MEDICIÓN =================
+
+#define RETARDO_MS(ms)  do{ INICIO_CICLOS(MED_RETARDO);                                       \
+                            for(unsigned int r = (ms); r != 0; r--) RETARDO_1MS();          \
+                            msBloqueados += (ms); FIN_CICLOS(MED_RETARDO); }while(0)
+// Retardo bloqueante que además acumula en msBloqueados el tiempo que el programa
+// principal pasó detenido. Desde que la bienvenida es un estado main() ya no tiene
+// esperas bloqueantes (msBloqueados queda en 0); si hiciera falta una, debe usar
+// este macro en lugar de __delay_ms() para que se vea en el simulador.
+
+// ================= COLA DE EVENTOS (ISR ? main) =================
+
+#define TAM_COLA_EVENTOS   16
+// Capacidad de la cola de eventos (potencia de 2 para usar máscara).
+
+// Códigos de tecla (los dígitos 0?9 usan su propio valor)
+#define TECLA_OK           10
+#define TECLA_EMERGENCIA   11
+#define TECLA_SUPR         12
+#define TECLA_REINICIO     13
+#define TECLA_FIN          14
+#define TECLA_LUZ          15
+
+// Eventos de teclado: código de tecla (0?15) + tipo en el nibble alto
+#define EV_SUELTA          0x10
+// Se soltó la tecla (EV_SUELTA | código).
+#define EV_LARGA           0x20
+// La tecla lleva TECLA_LARGA_ESCANEOS escaneos presionada (EV_LARGA | código).
+
+// Eventos que no son teclas
+#define EV_SEGUNDO         0x80
+// Pasó un segundo (cada 1000 ticks de Timer2).
+#define EV_PIEZA           0x81
+// El sensor de RC1 capturó al menos una pieza nueva.
+#define EV_TIEMPO          0x82
+// Se cumplió el temporizador del estado de la interfaz (lo genera main(), no la ISR).
+#define EV_META            0x83
+// El conteo llegó al objetivo (lo genera PasoConteo()).
+#define EV_RECETA_LISTA    0x84
+// La EEPROM quedó libre y se puede leer la receta pedida (lo genera AtiendeEventos()).
+
+// ================= ESCANEO DEL TECLADO =================
+
+#define MS_POR_SEGUNDO     1000
+// Ticks de Timer2 por segundo: el segundo sale del mismo reloj que los milisegundos.
+
+#define TECLADO_PERIODO_MS 5
+// El teclado se escanea cada 5 ms desde el tick de Timer2.
+// El antirrebote exige 4 muestras iguales seguidas ? una tecla se acepta en 20 ms.
+
+#define TECLA_LARGA_ESCANEOS 200
+// 200 escaneos × 5 ms = 1 s presionada para generar EV_LARGA.
+
+#define SIN_TECLA          0xFF
+// Valor de teclaSostenida cuando no hay ninguna tecla sostenida.
+
+// ================= OBJETIVO DE PIEZAS =================
+
+#define OBJETIVO_MAX       65535UL
+// Mayor objetivo aceptado (el conteo es de 16 bits).
+#define DIGITOS_OBJETIVO   5
+// Cifras que se pueden digitar para el objetivo y que se muestran en el conteo.
+#define CELDA_OBJETIVO     21
+// Celda de la pantalla virtual (segunda línea) donde empieza la entrada del objetivo.
+#define CELDA_FALTANTES    11
+// Celda de las 5 cifras de "Faltantes:" en la vista normal del conteo (celdas 11-15).
+
+// ================= CIFRAS GRANDES =================
+// Con OK durante el conteo los faltantes se muestran en cifras de 3 columnas por
+// 2 filas (15 de las 16 columnas), armadas con 5 segmentos de CGRAM compartidos.
+
+#define COLUMNAS_CIFRA     3
+// Columnas que ocupa cada cifra grande (sus 2 filas usan las mismas columnas).
+#define CIFRA_EN_BLANCO    10
+// Fila de cifraGrande[] sin nada: ceros a la izquierda.
+#define SIN_CIFRA          0xFF
+// Valor de cifraGrandeMostrada[] cuando la pantalla virtual no tiene esa cifra dibujada.
+
+// Vistas del conteo (vistaConteo), en el orden en que las recorre OK
+#define VISTA_NORMAL       0
+// "Faltantes:" y ritmo (o lote de la receta).
+#define VISTA_GRANDE       1
+// Faltantes en cifras grandes.
+#define TOTAL_VISTAS       2
+
+// ================= CONTEO MULTICARRIL =================
+
+//#define MULTICARRIL
+// Descomentar (o agregar MULTICARRIL en las macros del proyecto) cuando la estación
+// tiene varias líneas con un sensor cada una. Además del conteo por lotes de RC1
+// (CCP2), el tick de 1 ms lee PORTC completo y filtra los 8 bits a la vez con
+// contadores verticales, igual que el teclado: el costo es el mismo para 1 que
+// para 8 carriles. Cada carril cuenta hasta su propia meta y vuelve a empezar.
+// El conteo de cada carril se ve en EST_CARRILES (FIN en "Piezas a contar:").
+// Timer2 se detiene en Sleep y con él el muestreo de PORTC: con MULTICARRIL el
+// administrador de energía no pasa de ENERGIA_REPOSO.
+
+#ifndef CARRILES_ACTIVOS
+#define CARRILES_ACTIVOS   0b00110011
+#endif
+// Bits de PORTC con un sensor: RC0, RC1, RC4 y RC5 (RC2 es la parada de emergencia
+// y RC6/RC7 la EUSART). RC4 y RC5 solo pueden ser entradas (con el USB apagado,
+// como queda tras el reset). Sensores activos en bajo con pull-up externo: igual
+// que en RC1, la subida marca el fin de la pieza. El banco del simulador lo
+// redefine (-DCARRILES_ACTIVOS) para medir la ISR con 1 y con 8 carriles.
+#define TOTAL_CARRILES     8
+// Un carril por bit de PORTC (el número que ve el operador es el bit + 1).
+#define SEGUNDOS_POR_CARRIL 2
+// Segundos que se muestra cada carril antes de pasar al siguiente.
+#define CELDA_CARRIL        7
+#define CELDA_CONTEO_CARRIL 10
+#define CELDA_META_CARRIL   21
+#define CELDA_LOTES_CARRIL  28
+// "Carril 1: 00012" / "Meta 00100 L003" (L = veces que el carril llegó a su meta).
+
+// ================= PERSISTENCIA EN EEPROM =================
+
+// Mapa de los 256 bytes de EEPROM de datos:
+//   0x00-0x27  recetas 1 a 9 (4 bytes cada una, se cargan al programar el PIC)
+//   0x80-0xFF  registros del lote en curso (16 ranuras rotativas de 8 bytes)
+
+#define DIR_REGISTROS_EEPROM    0x80
+// Dirección de la primera ranura.
+#define TAM_REGISTRO_EEPROM     8
+// Bytes de cada registro guardado en la EEPROM de datos:
+//   0-1 secuencia (crece en 1 por registro), 2-3 piezasTotalesContadas,
+//   4-5 piezasObjetivo, 6 lote en curso, 7 verificación (XOR de 0-6 y SEMILLA).
+// Byte 6: 0 si no hay lote en conteo; si no, lote actual en el nibble alto (1-15)
+// y receta en el bajo (0 = objetivo digitado a mano).
+// Todos los valores de 16 bits se guardan con el byte bajo primero.
+#define TOTAL_REGISTROS_EEPROM  16
+// 128 bytes / 8 = 16 ranuras. Cada guardado usa la ranura siguiente,
+// así cada celda se escribe una vez cada 16 guardados.
+#define SEMILLA_EEPROM          0x5A
+// Hace que una ranura borrada (0xFF) o en 0 nunca pase la verificación.
+#define SEGUNDOS_ENTRE_GUARDADOS 60
+// Las piezas contadas se guardan como mucho una vez por este intervalo. Los cambios
+// de lote (inicio, FIN, REINICIO, cumplido) y la caída de tensión (HLVD) se guardan
+// en el momento, sin esperarlo.
+// Vida de la EEPROM: cada celda admite 100 000 escrituras (mínimo de la hoja de
+// datos) y cada ranura se reescribe una vez cada TOTAL_REGISTROS_EEPROM guardados.
+// Guardando cada 10 piezas, a 50 Hz eran 5 guardados por segundo y la EEPROM se
+// gastaba en 100 000 × 16 / 5 = 320 000 s, unas 89 h de conteo. Con un guardado
+// cada 60 s: 100 000 × 16 × 60 s = 96 000 000 s, unos 3 años de conteo continuo
+// (más de 3000 turnos de 8 h), sin importar el ritmo de las piezas.
+// A cambio, un corte sin aviso del HLVD pierde como mucho el último minuto de piezas.
+
+// ================= RECETAS =================
+// Una receta es un objetivo y cuántos lotes seguidos de ese objetivo se cuentan.
+// Se elige manteniendo presionada su tecla (1-9) en "Piezas a contar:" y los lotes
+// se encadenan solos: al cumplir uno empieza el siguiente sin esperar OK.
+
+#define DIR_RECETAS_EEPROM      0x00
+#define TAM_RECETA_EEPROM       4
+// 0-1 objetivo, 2 lotes, 3 verificación (XOR de 0-2 y SEMILLA_EEPROM).
+#define TOTAL_RECETAS           9
+// Una por tecla 1-9.
+#define LOTES_MAX               15
+// Lotes por receta (el lote actual se guarda en 4 bits del registro).
+
+#define RECETA(objetivo, lotes)  (objetivo) & 0xFF, (objetivo) >> 8, (lotes), \
+                                 (((objetivo) & 0xFF) ^ ((objetivo) >> 8) ^ (lotes) ^ SEMILLA_EEPROM)
+#define RECETA_VACIA             0xFF, 0xFF, 0xFF, 0xFF
+// Una receta vacía no pasa la verificación y su tecla no hace nada.
+#define DATOS_EEPROM(...)        __EEPROM_DATA(__VA_ARGS__)
+// Expande RECETA() antes de que __EEPROM_DATA cuente sus 8 argumentos.
+
+#define CELDA_LOTE              16
+// "L01/03" en la segunda línea del conteo cuando se corre una receta.
+
+// ================= MEDIDOR DE RITMO =================
+
+#define TAM_VENTANA_RITMO  16
+// Intervalos entre piezas que promedia el ritmo (potencia de 2 para usar máscara).
+#define RITMO_PARADA_S     60
+// Segundos sin actividad a partir de los cuales el ritmo se muestra en 0.
+#define CELDA_RITMO        23
+// Celda de la pantalla virtual donde van las 5 cifras del ritmo ("Ritmo: 00000 p/m").
+
+// ================= TELEMETRÍA POR EUSART (RC6 = TX) =================
+
+#define TAM_COLA_TX        64
+// Bytes de la cola de transmisión (potencia de 2 para usar máscara).
+
+// Trama: SINCRONISMO, tipo, a (16 bits), b (16 bits), CRC-8 ? 7 bytes.
+// a y b van con el byte bajo primero. El CRC-8 (polinomio 0x07, valor inicial 0)
+// se calcula sobre tipo, a y b. A 9600 baudios caben ~137 tramas por segundo,
+// casi el triple de una línea de 50 piezas por segundo.
+#define TAM_TRAMA          7
+#define TRAMA_SINCRONISMO  0xA5
+#define TRAMA_PIEZA        0x01
+// a = milisegundos, b = piezasTotalesContadas después de sumar las piezas nuevas.
+#define TRAMA_INICIO_LOTE  0x02
+// a = piezasObjetivo, b = piezasTotalesContadas (distinto de 0 en un lote recuperado).
+#define TRAMA_LOTE_CUMPLIDO 0x03
+// a = piezasObjetivo, b = piezasExcedentes.
+#define TRAMA_TECLA        0x04
+// a = milisegundos, b = código de tecla (con EV_SUELTA / EV_LARGA si corresponde).
+#define TRAMA_ENERGIA      0x05
+// a = milisegundos, b = ENERGIA_DORMIDO al suspenderse, ENERGIA_ACTIVO al despertar.
+#define TRAMA_EMERGENCIA   0x06
+// a = milisegundos, b = piezasTotalesContadas.
+#define TRAMA_PERDIDAS     0x07
+// a = milisegundos, b = tramasPerdidas (se envía cada segundo si aumentó).
+#define TRAMA_TRAZA        0x08
+// Solo con TRAZA_EVENTOS: a = evento (MED_* | TRAZA_SALE | TRAZA_RAPIDO), b = TMR3.
+
+// ================= MÁQUINA DE ESTADOS DE LA INTERFAZ =================
+
+#define EST_OBJETIVO       0   // pide "Piezas a contar:" y arma el objetivo
+#define EST_ERROR          1   // "!Error!" durante 1 s
+#define EST_LIMITES        2   // rango válido durante 2 s
+#define EST_CONTEO         3   // lote en conteo
+#define EST_CUMPLIDA       4   // "Cuenta Cumplida", espera OK
+#define EST_EMERGENCIA     5   // parada de emergencia, hasta el reset
+#define EST_BIENVENIDA     6   // mensaje y animación de bienvenida
+#ifdef MULTICARRIL
+#define EST_CARRILES       7   // conteo de cada carril, uno a la vez
+#define TOTAL_ESTADOS_UI   8
+#else
+#define TOTAL_ESTADOS_UI   7
+#endif
+
+#define BIENVENIDA_MS      3200
+// Tiempo que el mensaje de bienvenida queda quieto antes de desplazarse.
+#define PASOS_BIENVENIDA   18
+// Desplazamientos de la animación, uno cada PASO_BIENVENIDA_MS.
+#define PASO_BIENVENIDA_MS 100
+
+#define EST_CUALQUIERA     0xFF
+// Solo en transicionesUI[]: la fila vale en todos los estados.
+#define EV_DIGITO          0xFE
+// Solo en transicionesUI[]: cualquier tecla 0-9.
+#define EV_RECETA          0xFD
+// Solo en transicionesUI[]: cualquier tecla 1-9 sostenida (EV_LARGA | 1-9).
+#define EV_CUALQUIERA      0xFF
+// Solo en transicionesUI[]: cualquier evento.
+
+#define TICKS_TMR3_1MHZ    31250UL
+// Cuentas de Timer3 (Fosc/4, 1:8) por segundo a 1 MHz; a 8 MHz son 8 veces más.
+
+// ================= ADMINISTRADOR DE ENERGÍA =================
+
+#define SEGUNDOS_PARA_DORMIR 20
+// Segundos de inactividad (sin piezas ni teclas) para pasar a ENERGIA_DORMIDO.
+#ifdef MULTICARRIL
+#define PERMITE_DORMIDO    0
+// Los carriles se muestrean en el tick de Timer2, que se detiene en Sleep: un
+// carril que cuenta con el PIC dormido perdería todas sus piezas. Solo REPOSO.
+#else
+#define PERMITE_DORMIDO    1
+#endif
+
+// Estados de energía (estadoEnergia)
+// Consumos típicos del PIC solo (PIC18F4550 a 5 V y 25 °C, hoja de datos DS39632,
+// sección 28.2, "Power-Down and Supply Current"); el LCD, los LEDs y el buzzer se
+// suman aparte y en ACTIVO y REPOSO suelen ser la mayor parte.
+#define ENERGIA_ACTIVO     0
+// CPU y periféricos funcionando: hay eventos o piezas por atender.
+// Consumo (PRI_RUN con INTOSC): ~1 mA en PERFIL_LENTO (1 MHz), ~4 mA en PERFIL_RAPIDO (8 MHz).
+#define ENERGIA_REPOSO     1
+// PRI_IDLE (IDLEN = 1): se detiene solo la CPU. Timer2 y Timer3/CCP2 siguen
+// con el oscilador principal, así que el conteo no pierde piezas. Despierta con
+// cualquier interrupción (a lo sumo 1 ms con el tick de Timer2).
+// Consumo (PRI_IDLE): ~0.5 mA en PERFIL_LENTO y ~1.5 mA en PERFIL_RAPIDO; el
+// oscilador y los periféricos siguen, sin la CPU.
+#define ENERGIA_DORMIDO    2
+// Sleep (IDLEN = 0): se detienen todos los relojes, incluidos Timer3 y CCP2, y
+// Timer2 con el reloj del sistema (milisegundos y segundosSistema quedan quietos).
+// Solo despierta con una tecla (cambio en RB4-RB7). RC1/CCP2 NO puede despertar al
+// PIC de este modo: la captura necesita Timer3 y el reloj de instrucción, que están
+// detenidos, y RC1 no es una entrada INT0-INT2. Una pieza que pasa dormido se pierde;
+// por eso solo se duerme fuera de un lote (flagConteoActivo en 0, ver el escenario
+// energia_lote).
+// Consumo (Sleep): ~0.1 uA del PIC, el mismo en los dos perfiles (el oscilador se
+// detiene), más unos 20 uA del HLVD, que queda encendido para la caída de tensión.
+
 
                  //RGB - decenas 
                 //RE2=Rojo
@@ -37,8 +436,8 @@
 
 // =========================== CARACTERES ESPECIALES LCD ===========================
 
-// Carcter propio: estrella (se guarda en CGRAM del LCD)
-unsigned char Estrella[8] = {
+// Carácter propio: estrella (se guarda en CGRAM del LCD)
+const unsigned char Estrella[8] = {
     0b00100,   
     0b01110,  //  *** 
     0b11111,  // *****
@@ -46,14 +445,14 @@ unsigned char Estrella[8] = {
     0b11111,  // *****
     0b01110,  //  *** 
     0b00100,  //   *  
-    0b00000   // vaco
+    0b00000   // vacío
 };
-// Este arreglo define 8 filas de 5 bits del carcter especial "estrella".
-// Se usar en la funcin Bienvenida(), donde se llama CrearCaracter(Estrella, 0)
-// para guardarla en la posicin 0 de la CGRAM del LCD.
+// Este arreglo define 8 filas de 5 bits del carácter especial "estrella".
+// Se usará en EntraBienvenida(), donde se llama CrearCaracter(Estrella, GLIFO_ESTRELLA)
+// para guardarla en la posición 0 de la CGRAM del LCD. Por ser const queda en flash.
 
-// Carcter propio: marco/cuadro para marcar entrada de datos
-unsigned char Marco[8] = {
+// Carácter propio: marco/cuadro para marcar entrada de datos
+const unsigned char Marco[8] = {
     0b11111,
     0b10001,
     0b10001,
@@ -63,97 +462,709 @@ unsigned char Marco[8] = {
     0b10001,
     0b11111   // Marco de 5x8 lleno en el borde
 };
-// Este arreglo define un ?cuadro? para subrayar/encuadrar la posicin donde el usuario digita.
-// Se usar en PreguntaAlUsuario(), llamando a CrearCaracter(Marco, 1) para guardarlo
-// en la posicin 1 de CGRAM y luego se imprime con EscribeLCD_c(1).
+// Este arreglo define un ?cuadro? para subrayar/encuadrar la posición donde el usuario digita.
+// Se usará en EntraObjetivo(), llamando a CrearCaracter(Marco, GLIFO_MARCO) para
+// guardarlo en la posición 1 de CGRAM y luego se imprime como el carácter 1.
+
+#define GLIFO_ESTRELLA     0
+// Posición de CGRAM de la estrella.
+#define GLIFO_MARCO        1
+// Posición de CGRAM del marco.
+
+// Segmentos de las cifras grandes (posiciones 2-6 de CGRAM; la 7 queda libre).
+// Las barras ocupan las 5 columnas de la celda; los lados, 3 columnas hacia el centro
+// de la cifra, para que entre dos cifras seguidas quede un espacio.
+const unsigned char BarraSuperior[8] = {
+    0b11111, 0b11111, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000
+};
+const unsigned char BarraInferior[8] = {
+    0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b11111, 0b11111
+};
+const unsigned char BarrasDobles[8] = {
+    0b11111, 0b11111, 0b00000, 0b00000, 0b00000, 0b00000, 0b11111, 0b11111
+};
+const unsigned char LadoIzquierdo[8] = {
+    0b00111, 0b00111, 0b00111, 0b00111, 0b00111, 0b00111, 0b00111, 0b00111
+};
+const unsigned char LadoDerecho[8] = {
+    0b11100, 0b11100, 0b11100, 0b11100, 0b11100, 0b11100, 0b11100, 0b11100
+};
+
+#define GLIFO_BARRA_SUP    2
+#define GLIFO_BARRA_INF    3
+#define GLIFO_BARRAS       4
+#define GLIFO_LADO_IZQ     5
+#define GLIFO_LADO_DER     6
+
+// Celdas de cada cifra grande: 3 de la primera fila y 3 de la segunda.
+// La barra del medio de la cifra es la BarraInferior de la primera fila.
+const unsigned char cifraGrande[11][2 * COLUMNAS_CIFRA] = {
+    {GLIFO_LADO_IZQ, GLIFO_BARRA_SUP, GLIFO_LADO_DER,  GLIFO_LADO_IZQ,  GLIFO_BARRA_INF, GLIFO_LADO_DER},  // 0
+    {' ',            ' ',             GLIFO_LADO_DER,  ' ',             ' ',             GLIFO_LADO_DER},  // 1
+    {GLIFO_BARRAS,   GLIFO_BARRAS,    GLIFO_LADO_DER,  GLIFO_LADO_IZQ,  GLIFO_BARRA_INF, GLIFO_BARRA_INF},  // 2
+    {GLIFO_BARRAS,   GLIFO_BARRAS,    GLIFO_LADO_DER,  GLIFO_BARRA_INF, GLIFO_BARRA_INF, GLIFO_LADO_DER},  // 3
+    {GLIFO_LADO_IZQ, GLIFO_BARRA_INF, GLIFO_LADO_DER,  ' ',             ' ',             GLIFO_LADO_DER},  // 4
+    {GLIFO_LADO_IZQ, GLIFO_BARRAS,    GLIFO_BARRAS,    GLIFO_BARRA_INF, GLIFO_BARRA_INF, GLIFO_LADO_DER},  // 5
+    {GLIFO_LADO_IZQ, GLIFO_BARRAS,    GLIFO_BARRAS,    GLIFO_LADO_IZQ,  GLIFO_BARRA_INF, GLIFO_LADO_DER},  // 6
+    {GLIFO_BARRA_SUP,GLIFO_BARRA_SUP, GLIFO_LADO_DER,  ' ',             ' ',             GLIFO_LADO_DER},  // 7
+    {GLIFO_LADO_IZQ, GLIFO_BARRAS,    GLIFO_LADO_DER,  GLIFO_LADO_IZQ,  GLIFO_BARRA_INF, GLIFO_LADO_DER},  // 8
+    {GLIFO_LADO_IZQ, GLIFO_BARRAS,    GLIFO_LADO_DER,  GLIFO_BARRA_INF, GLIFO_BARRA_INF, GLIFO_LADO_DER},  // 9
+    {' ',            ' ',             ' ',             ' ',             ' ',             ' '}              // CIFRA_EN_BLANCO
+};
+
+// =========================== PANTALLAS ===========================
+// Cada pantalla fija es una tabla const (en la memoria de programa) que
+// DibujaPantalla() copia a la pantalla virtual; los números que cambian se
+// escriben después con EscribeFB_bcd/EscribeFB_n16. Solo se listan las celdas
+// con contenido: los espacios de relleno ya los deja BorraFB().
+
+const ElementoPantalla pantallaBienvenida[] = {
+    {0,  GLIFO_ESTRELLA, 2, 0},
+    {3,  0, 0, "Bienvenido"},
+    {14, GLIFO_ESTRELLA, 2, 0},
+    {16, GLIFO_ESTRELLA, 2, 0},
+    {20, 0, 0, "Operario"},
+    {29, GLIFO_ESTRELLA, 2, 0},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+// "Bienvenido" y "Operario" rodeados de estrellas.
+
+const ElementoPantalla pantallaObjetivo[] = {
+    {0,  0, 0, "Piezas a contar:"},
+    {CELDA_OBJETIVO, GLIFO_MARCO, DIGITOS_OBJETIVO, 0},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+// Un marco por cifra del objetivo (celdas 21-25 = 0xC5-0xC9).
+
+const ElementoPantalla pantallaError[] = {
+    {5,  0, 0, "!Error!"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+
+const ElementoPantalla pantallaLimites[] = {
+    {0,  0, 0, "Valor max: 65535"},
+    {16, 0, 0, "Valor min: 1"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+
+const ElementoPantalla pantallaConteo[] = {
+    {0,  0, 0, "Faltantes:"},
+    {16, 0, 0, "Ritmo:"},
+    {29, 0, 0, "p/m"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+// Faltantes en CELDA_FALTANTES y ritmo en CELDA_RITMO (los escribe el programa).
+
+const ElementoPantalla pantallaConteoReceta[] = {
+    {0,  0, 0, "Faltantes:"},
+    {CELDA_LOTE, 0, 0, "L"},
+    {CELDA_LOTE + 3, 0, 0, "/"},
+    {29, 0, 0, "p/m"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+// Con receta la palabra "Ritmo:" deja lugar a "Lkk/nn" (lote k de n).
+
+#ifdef MULTICARRIL
+const ElementoPantalla pantallaCarriles[] = {
+    {0,  0, 0, "Carril"},
+    {CELDA_CARRIL + 1, 0, 0, ":"},
+    {16, 0, 0, "Meta"},
+    {CELDA_LOTES_CARRIL - 1, 0, 0, "L"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+// Número de carril, piezas, meta y metas cumplidas los escribe MuestraCarril().
+#endif
+
+const ElementoPantalla pantallaCumplida[] = {
+    {0,  0, 0, "Cuenta Cumplida"},
+    {20, 0, 0, "Presione OK"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+
+const ElementoPantalla pantallaEmergencia[] = {
+    {4,  0, 0, "PARADA DE"},
+    {18, 0, 0, "EMERGENCIA"},
+    {FIN_PANTALLA, 0, 0, 0}
+};
+
+// =========================== RECETAS EN EEPROM ===========================
+// Contenido inicial de la EEPROM de datos (lo escribe el programador junto con
+// la flash). Cada DATOS_EEPROM son 8 bytes: dos recetas.
+
+DATOS_EEPROM(RECETA(100, 3),  RECETA(250, 2));     // recetas 1 y 2
+DATOS_EEPROM(RECETA(500, 1),  RECETA(50, 10));     // recetas 3 y 4
+DATOS_EEPROM(RECETA(1000, 1), RECETA_VACIA);       // recetas 5 y 6
+DATOS_EEPROM(RECETA_VACIA,    RECETA_VACIA);       // recetas 7 y 8
+DATOS_EEPROM(RECETA_VACIA,    RECETA_VACIA);       // receta 9 y relleno
 
 // =========================== VARIABLES GLOBALES ===========================
 
+// Medidor de ritmo (lo alimenta la ISR en cada pieza aceptada)
+volatile unsigned int intervalosPieza[TAM_VENTANA_RITMO];
+// Últimos intervalos entre piezas, en ms (ventana circular).
+volatile unsigned char indiceIntervalo;
+// Posición del próximo intervalo (y del más viejo cuando la ventana está llena).
+volatile unsigned char totalIntervalos;
+// Intervalos válidos en la ventana (0 a TAM_VENTANA_RITMO).
+volatile unsigned long sumaIntervalos;
+// Suma de los intervalos de la ventana: se actualiza restando el que sale y sumando
+// el que entra, así cada pieza cuesta lo mismo sin importar el tamaño de la ventana.
+volatile unsigned int ultimaPiezaMs;
+// Valor de milisegundos en la última pieza aceptada.
+volatile unsigned char hayPiezaPrevia;
+// 1 ? ultimaPiezaMs es válida y la próxima pieza ya cierra un intervalo.
+unsigned int piezasPorMinuto;
+// Último ritmo calculado (lo que muestra el LCD).
+
+// Telemetría por EUSART
+unsigned char colaTX[TAM_COLA_TX];
+volatile unsigned char colaTXEntrada;
+// Solo la escribe main() (EnviaTrama).
+volatile unsigned char colaTXSalida;
+// Solo la escribe la ISR de transmisión.
+unsigned int tramasPerdidas;
+// Tramas descartadas porque no cabían en la cola.
+unsigned int tramasPerdidasAvisadas;
+// Valor de tramasPerdidas en la última TRAMA_PERDIDAS enviada.
+
+// Persistencia en EEPROM
+unsigned char registroEEPROM[TAM_REGISTRO_EEPROM];
+// Registro que se está escribiendo (lo arma main(), lo recorre la ISR).
+volatile unsigned char bytesEEPROMPendientes;
+// Bytes del registro que faltan por escribir (0 ? la EEPROM está libre).
+volatile unsigned char direccionEEPROM;
+// Dirección del byte que se está escribiendo.
+unsigned char ranuraEEPROM;
+// Ranura (0-15) del último registro escrito o recuperado.
+unsigned int secuenciaEEPROM;
+// Secuencia del último registro escrito o recuperado.
+unsigned char guardadoPendiente;
+// 1 ? hay que guardar el estado en cuanto la EEPROM quede libre.
+unsigned int piezasSinGuardar;
+// Piezas contadas desde el último guardado (a 100 Hz son 6000 en un intervalo).
+unsigned char segundosSinGuardar;
+// Segundos desde el último guardado (se detiene en 255).
+volatile unsigned char caidaTension;
+// 1 ? el módulo HLVD detectó que VDD está bajando (lo pone la ISR).
+unsigned char loteRecuperado;
+// 1 ? al arrancar se recuperó un lote sin terminar: main() sigue contando sin preguntar.
+unsigned int guardadosEEPROM;
+// Registros escritos desde el arranque.
+
+// Recetas
+unsigned char recetaActiva;
+// Receta que se está corriendo (1-9), o 0 si el objetivo se digitó a mano.
+unsigned char recetaPedida;
+// Receta 1-9 que espera a que la EEPROM termine el registro en curso para leerse,
+// o 0 si no hay ninguna (la pide TeclaReceta(), la lee CargaReceta()).
+unsigned char loteActual;
+// Lote en curso (1 a lotesReceta).
+unsigned char lotesReceta;
+// Lotes de la receta activa (1 con objetivo digitado a mano).
+
+// Perfiles de reloj: una columna por perfil (PERFIL_LENTO, PERFIL_RAPIDO)
+const unsigned char perfilOSCCON[TOTAL_PERFILES] = {
+    0b01000000,     // IRCF = 100 ? INTOSC 1 MHz
+    0b01110000      // IRCF = 111 ? INTOSC 8 MHz
+};
+// Bits IRCF de OSCCON. SCS queda en 00: el oscilador principal ya es INTOSC (FOSC=INTOSC_EC).
+
+const unsigned char perfilT2CON[TOTAL_PERFILES] = {
+    0b00000100,     // prescaler 1:1, postscaler 1:1: 250 ciclos = 1 ms
+    0b00001101      // prescaler 1:4, postscaler 1:2: 250 × 4 × 2 = 2000 ciclos = 1 ms
+};
+// Timer2 (tick de 1 ms) con PR2 = 249 en los dos perfiles. Es la base de tiempo de
+// todo el programa: PR2 reinicia la cuenta por hardware, así que la latencia de la
+// ISR no se acumula y ni los milisegundos ni los segundos derivan.
+
+const unsigned int perfilPiezaMinTicks[TOTAL_PERFILES] = {
+    TICKS_TIMER3(PIEZA_MIN_US, 250000UL),   // 156 ticks de 32 us
+    TICKS_TIMER3(PIEZA_MIN_US, 2000000UL)   // 1250 ticks de 4 us
+};
+
+const unsigned char perfilMultiplicador[TOTAL_PERFILES] = {1, 8};
+// Valor de multiplicadorReloj en cada perfil.
+
+const unsigned char perfilSPBRG[TOTAL_PERFILES] = {25, 207};
+// EUSART a 9600 baudios (BRG16 = 1, BRGH = 1: Fosc / (4 × (SPBRG + 1)) = 9615, 0.16 %).
+
+unsigned int piezaMinTicks;
+// Filtro de rebote de RC1 en ticks de Timer3 del perfil activo (la usa la ISR).
+
+// Administrador de energía
+unsigned char estadoEnergia;
+// ENERGIA_ACTIVO, ENERGIA_REPOSO o ENERGIA_DORMIDO (el último elegido por AdministraEnergia()).
+unsigned int vecesDormido;
+// Cuántas veces se entró en ENERGIA_DORMIDO.
+unsigned char porcentajeReposo;
+// Porcentaje del último segundo que la CPU pasó en ENERGIA_REPOSO (0-100).
+// Se recalcula en cada EV_SEGUNDO; el resto es trabajo de main() y de la ISR.
+unsigned long ticksReposo;
+// Cuentas de Timer3 en reposo acumuladas en el segundo en curso.
+unsigned int inicioReposo;
+// TMR3 al entrar en reposo.
+unsigned int latenciaReposoMax;
+// Peor latencia medida entre un flanco de RC1 y la vuelta de main() desde ENERGIA_REPOSO,
+// en ciclos de instrucción (ticks de Timer3 × 8, igual en todo perfil de reloj).
+// CCPR2 tiene la hora exacta del flanco que despertó al PIC.
+unsigned int latenciaPieza;
+unsigned int latenciaPiezaMax[TOTAL_PERFILES];
+// Ciclos de instrucción entre un flanco de RC1 (CCPR2) y la rama de CCP2 de la ISR, la
+// última y la peor en cada perfil. Un ciclo dura 4 us en PERFIL_LENTO y 0.5 us en
+// PERFIL_RAPIDO; el flanco siguiente no puede llegar antes de PIEZA_MIN_US.
+unsigned int esperaTXMax[TOTAL_PERFILES];
+// Peor espera de FijaPerfilReloj() a que TRMT quede en 1, por perfil del que se sale,
+// en ciclos de instrucción. VaciaColaTX() vuelve con un byte en TXREG y otro en el
+// registro de desplazamiento: cota de dos bytes a 9600 baudios (2.08 ms), 521 ciclos
+// en PERFIL_LENTO y 4167 en PERFIL_RAPIDO, más una ISR que demore la salida.
+unsigned int esperaPerfilMax[TOTAL_PERFILES];
+// Peor espera de FijaPerfilReloj() a que la ISR aplique el perfil, por perfil del que
+// se sale, en ciclos. Cota: un tick de Timer2 (250 o 2000 ciclos) más esa ISR.
+unsigned int esperaIOFSMax;
+// Peor espera de AplicaPerfilReloj() a IOFS, en ciclos. Los dos perfiles son salidas
+// del postscaler del mismo INTOSC de 8 MHz, que nunca se detiene al cambiar IRCF:
+// IOFS sigue en 1 y el while sale en la primera prueba.
+unsigned int msEsperaEmergencia;
+// Lo que tardó EntraEmergencia() en dejar guardado el lote, en ms. Cota: el registro
+// que estaba a medias más el de la emergencia, 2 × TAM_REGISTRO_EEPROM bytes de ~4 ms.
+unsigned int msDespertarTeclado;
+// Última latencia desde que una tecla despertó al PIC de ENERGIA_DORMIDO hasta que
+// main() recibió la tecla ya antirrebotada (en ms; incluye los 20 ms del antirrebote).
+unsigned int inicioDespertar;
+// Valor de milisegundos al despertar de ENERGIA_DORMIDO.
+unsigned char midiendoDespertar;
+// 1 ? se espera la primera tecla después de despertar para medir msDespertarTeclado.
+
 // Contadores de piezas
 unsigned int piezasTotalesContadas;   
-// Lleva el total de piezas contadas desde que se inici o se reinici el sistema.
-// Se incrementa en el while principal cuando se detecta un flanco de subida en RC1.
-// Se compara contra piezasObjetivo para saber si ya se alcanz la meta.
+// Lleva el total de piezas contadas en el lote en curso.
+// Lo incrementa PasoConteo(), una vez por cada pieza que la ISR dejó en
+// piezasPendientes (flanco de RC1 capturado por CCP2). TeclaFin() lo iguala al
+// objetivo y RecuperaEstado() lo restaura de la EEPROM.
+// Se compara contra piezasObjetivo para saber si ya se alcanzó la meta.
 
 unsigned int unidades7Seg;           
 // Representa las unidades (0?9) que se muestran en el display de 7 segmentos.
-// Se incrementa cada vez que se cuenta una pieza (RC1 detectado).
+// PasoConteo() lo incrementa con cada pieza que toma de piezasPendientes.
 // Cuando llega a 10, se reinicia a 0 y se incrementa decenasRGB.
+// CalculaSalidas() lo calcula de una vez (FIN y lote recuperado).
 
 unsigned int decenasRGB;             
 // Contiene las decenas (0?5) que se representan con el LED RGB.
-// Cada 10 piezas incrementa en 1. Cuando llega a 6, se reinicia a 0.
-// Se usa para cambiar el color del RGB usando LATE en el while principal
-// y tambin cuando se fuerza FIN.
+// Cada 10 piezas incrementa en 1. Cuando llega a 6, se reinicia a 0: el RGB muestra
+// las decenas módulo 6 y repite los colores cada 60 piezas (el rojo queda reservado
+// para la parada de emergencia). El 7 segmentos muestra siempre las unidades.
+// Es el índice de coloresDecena[] que usa ActualizaSalidas() para escribir LATE.
 
 // Entrada del objetivo por teclado
 unsigned char indiceDigitoObjetivo;  
-// Indica qu dgito del objetivo est ingresando el usuario:
-// 0 ? primer dgito (decenas), 1 ? segundo dgito (unidades).
-// Se usa en ConfigPregunta() y se reinicia en ConfigVariables() y PreguntaAlUsuario().
+// Cantidad de cifras del objetivo que ya digitó el usuario (0 a DIGITOS_OBJETIVO).
+// Se usa en ConfigPregunta() y se reinicia en ConfigVariables() y EntraObjetivo().
 
 unsigned char modoEdicionObjetivo;   
-// Bandera: 1 ? el usuario est escribiendo el objetivo en el LCD,
-// 0 ? ya no se est editando.
-// Se usa en PreguntaAlUsuario(), ConfigPregunta() y Borrar().
+// Bandera: 1 ? el usuario está escribiendo el objetivo en el LCD,
+// 0 ? ya no se está editando.
+// Se usa en EntraObjetivo(), ConfigPregunta() y Borrar().
 
 unsigned int piezasObjetivo;         
-// Meta de piezas que se desean contar. Debe estar entre 1 y 59.
+// Meta de piezas que se desean contar. Debe estar entre 1 y OBJETIVO_MAX.
 // Se construye a partir de las teclas del teclado matricial en ConfigPregunta()
-// y se valida en PreguntaAlUsuario().
+// y se valida en TeclaAceptar() (0 = inválido).
+
+unsigned long faltantesBCD;
+// Piezas que faltan para el objetivo, en BCD empaquetado (una cifra por nibble, hasta 5).
+// Se carga con BinarioABCD16() al empezar el lote y baja con DecrementaBCD() por
+// cada pieza: el LCD solo separa nibbles y nunca divide entre 10.
+
+unsigned char vistaConteo;
+// VISTA_NORMAL o VISTA_GRANDE (se cambia con OK en EST_CONTEO).
+// No se reinicia entre lotes: queda la vista que eligió el operador.
+unsigned char cifraGrandeMostrada[DIGITOS_OBJETIVO];
+// Fila de cifraGrande[] que ya está en la pantalla virtual para cada cifra, o SIN_CIFRA.
+// MuestraFaltantes() solo reescribe las columnas de las cifras que cambiaron.
+unsigned char midiendoBytesFaltantes;
+// 1 ? el próximo RefrescaLCD() lleva una actualización de faltantes de PasoConteo().
+unsigned char bytesFaltantes;
+unsigned char bytesMaxFaltantes;
+// Bytes al LCD de la última y de la peor actualización de faltantes en la vista actual
+// (se reinician al cambiar de vista, para comparar las dos en el simulador).
+
+#ifdef MULTICARRIL
+// Conteo multicarril (PORTC)
+unsigned char estadoCarriles;
+// Estado filtrado de cada bit de CARRILES_ACTIVOS (1 = entrada en alto).
+unsigned char contadorCarriles0;
+unsigned char contadorCarriles1;
+// Contadores verticales de 2 bits: un carril cambia tras 4 muestras (4 ms) iguales.
+volatile unsigned int conteoCarril[TOTAL_CARRILES];
+// Piezas del carril desde que empezó su meta actual (las suma la ISR).
+volatile unsigned char lotesCarril[TOTAL_CARRILES];
+// Veces que el carril llegó a su meta.
+const unsigned int metaCarril[TOTAL_CARRILES] = {
+    100, 100, 0, 0, 250, 250, 0, 0
+};
+// Meta de cada carril (en flash, se cambia aquí como las recetas). 0 = sin meta.
+unsigned char carrilMostrado;
+// Bit del carril que está en el LCD en EST_CARRILES.
+unsigned char segundosCarril;
+// Segundos que lleva en el LCD el carril actual.
+#endif
 
 // Control del flujo de conteo
 unsigned char flagConteoActivo;      
-// 1 ? se est en el ciclo de conteo (while interno).
-// 0 ? no se est contando (permite salir del while interno y volver a pedir objetivo).
-// Se activa al inicio del conteo y se pone en 0 cuando se cumple la cuenta.
+// 1 ? hay un lote en conteo (EST_CONTEO; se guarda en la EEPROM).
+// 0 ? no se está contando.
+// Se activa en EntraConteo() y se pone en 0 en EntraCumplida().
 
 unsigned char teclaLeida;            
-// Guarda la ltima tecla detectada en el teclado matricial.
-// Se actualiza en la ISR (interrupcin de PORTB) y se consulta en PreguntaAlUsuario()
-// y en el while que espera la tecla OK ('*') despus de cumplir la cuenta.
+// Guarda la última tecla presionada (código 0-15).
+// La escribe DespachaUI() en main() antes de ejecutar la acción y la usa ConfigPregunta().
+// No la toca la ISR: las teclas llegan por la cola de eventos.
+
+// Máquina de estados de la interfaz
+unsigned char estadoUI;
+// Estado actual (EST_*). Solo lo cambia CambiaEstadoUI().
+unsigned int inicioTemporizadorUI;
+// Milisegundos al armar el temporizador del estado.
+unsigned int duracionTemporizadorUI;
+// Milisegundos hasta EV_TIEMPO, o 0 si no hay temporizador armado.
+unsigned char pasosBienvenida;
+// Desplazamientos de la animación de bienvenida ya hechos.
+
+// Motor de conteo por captura (CCP2 en RC1)
+volatile unsigned int piezasPendientes;
+// Piezas detectadas por hardware (flanco de subida en RC1) que la ISR ya registró
+// pero que main() todavía no ha reflejado en contadores, RGB, 7 segmentos y LCD.
+// Solo la ISR la incrementa; main() la lee y la pone en 0 con CCP2IE deshabilitado.
+
+volatile unsigned int ultimaCaptura;
+// Valor de Timer3 (CCPR2) capturado en el último flanco aceptado como pieza.
+// Sirve como marca de tiempo de la pieza y para el filtro de rebotes (piezaMinTicks).
+
+volatile unsigned char desbordesTimer3;
+// Vueltas de Timer3 desde la última pieza aceptada, saturado en 2.
+// Con 0 la resta de capturas es la distancia entre los flancos; con 1 también, salvo
+// que CCPR2 haya alcanzado a ultimaCaptura (pasó una vuelta entera); con 2 seguro
+// pasó más de una vuelta y el flanco se acepta sin comparar.
+
+unsigned char beepActivo;
+// 1 ? el buzzer de RA2 está sonando por una decena completada.
+// Se apaga en PasoConteo() cuando pasan BEEP_DECENA_MS desde inicioBeep.
+
+unsigned int inicioBeep;
+// Valor de milisegundos en el momento en que empezó el beep de decena.
+
+// Cola de eventos ISR ? main (un productor, un consumidor, sin bloqueos)
+volatile unsigned char colaEventos[TAM_COLA_EVENTOS];
+volatile unsigned char colaEventosEntrada;
+// Solo la escribe la ISR (PonEvento).
+volatile unsigned char colaEventosSalida;
+// Solo la escribe main() (AtiendeEventos).
+volatile unsigned char eventosPerdidos;
+// Eventos descartados porque la cola estaba llena (debería quedar en 0).
+
+volatile unsigned int milisegundos;
+// Reloj del sistema: 1 ms por tick de Timer2. Toda marca de tiempo, espera y ritmo
+// se mide con él (LeeMilisegundos()); da la vuelta cada 65.5 s, así que se usan
+// siempre restas sin signo entre dos lecturas.
+// Timer2 se detiene en Sleep: durante ENERGIA_DORMIDO ni milisegundos ni
+// segundosSistema avanzan, y el tiempo dormido no queda contado en ningún lado.
+unsigned int divisorSegundo;
+// Cuenta ticks de 1 ms hasta MS_POR_SEGUNDO.
+unsigned long segundosSistema;
+// Segundos desde el arranque, del mismo tick (un turno de 8 h son 28800 s). Para
+// tramos más largos que la vuelta de milisegundos; se consulta con el depurador.
+
+// Teclado: mapa de teclas y antirrebote por contadores verticales
+const unsigned char mapaTeclas[16] = {
+    1,              2,  3,          TECLA_OK,           // fila 1 (RB0)
+    4,              5,  6,          TECLA_EMERGENCIA,   // fila 2 (RB1)
+    7,              8,  9,          TECLA_SUPR,         // fila 3 (RB2)
+    TECLA_REINICIO, 0,  TECLA_FIN,  TECLA_LUZ           // fila 4 (RB3)
+};
+// Código de cada tecla según su bit: bit = fila × 4 + columna (RB4 = columna 0).
+// Reemplaza la escalera de if/else que había en la ISR de PORTB.
 
-unsigned char pulsadorListo;         
-// Bandera de antirrebote para el pulsador/sensor en RC1.
-// 1 ? listo para detectar una nueva pulsacin (espera bajada),
-// 0 ? ya se detect bajada y se est esperando la subida.
-// Se usa en el bucle de conteo para evitar mltiples conteos por un mismo pulso.
+const unsigned char filasTeclado[4] = {
+    0b11111110, 0b11111101, 0b11111011, 0b11110111
+};
+// Valor de LATB para activar (poner en 0) cada fila durante el escaneo.
+
+unsigned int estadoTeclas;
+// Estado sin rebotes de las 16 teclas (bit en 1 ? tecla presionada).
+unsigned int contadorTeclas0;
+unsigned int contadorTeclas1;
+// Contador vertical de 2 bits por tecla: bit 0 y bit 1 de cada contador en
+// la misma posición. Cuenta las muestras seguidas que difieren de estadoTeclas.
+unsigned char divisorTeclado;
+// Cuenta ticks de 1 ms hasta TECLADO_PERIODO_MS.
+unsigned char teclaSostenida;
+// Bit de la última tecla presionada (para EV_LARGA), o SIN_TECLA.
+unsigned char escaneosSostenida;
+// Escaneos que lleva presionada teclaSostenida.
+
+// Salidas: color del LED RGB para cada decena (lógica inversa en RE0-RE2)
+const unsigned char coloresDecena[6] = {
+    0b00000001,     // 0 decenas: Magenta (Rojo+Azul)
+    0b00000101,     // 1: Azul
+    0b00000100,     // 2: Cyan
+    0b00000110,     // 3: Verde
+    0b00000010,     // 4: Amarillo
+    0b00000000      // 5: Blanco
+};
+// Reemplaza las escaleras de if/else que había en el conteo y en la tecla FIN.
+
+// Medición del conteo y de los bloqueos (se leen con el depurador o el simulador)
+unsigned long piezasContadasTotal;
+// Piezas contadas desde el arranque, sumando todos los lotes.
+unsigned int piezasExcedentes;
+// Piezas que pasaron fuera del conteo: después de cumplir la meta o mientras
+// no había un lote activo (ingreso del objetivo, "Cuenta Cumplida").
+volatile unsigned int flancosRechazados;
+// Flancos de RC1 descartados por el filtro de rebote (piezaMinTicks).
+unsigned long msBloqueados;
+// Milisegundos que main() pasó en retardos bloqueantes (RETARDO_MS).
+unsigned int msArranqueConteo;
+// Banco de pruebas: milisegundos desde que arrancó Timer2 (pocos ciclos después del
+// reset) hasta que un lote recuperado vuelve a EST_CONTEO. La captura de RC1 ya está
+// activa antes; este número mide cuándo el conteo vuelve al LCD y a las salidas
+// (tests/host/escenarios/arranque_recuperado.esc lo limita a 5 ms).
+
+// Medición de la latencia de interrupción
+unsigned int inicioISR;
+unsigned int duracionISR;
+// Marca de entrada y duración de la ISR actual (de uso interno de la ISR).
+unsigned int ciclosMaxISR;
+// Peor duración de la ISR medida hasta ahora, en ciclos de instrucción (Timer3 × 8).
+// Se consulta con el depurador o el simulador para comparar cambios.
+
+// Parada de emergencia por hardware (RC2 / CCP1, vector de alta prioridad)
+volatile unsigned char paradaPendiente;
+// 1 ? ISRParada() ya dejó las salidas seguras y main() todavía no pasó a EST_EMERGENCIA.
+unsigned int latenciaParada;
+unsigned int latenciaParadaMax;
+// Ciclos de instrucción entre el flanco de RC2 (CCPR1) y la escritura de LATE en
+// ISRParada(), última y peor medida (Timer3 × 8, igual en todo perfil de reloj).
 
 // Inactividad
 unsigned char segundosSinActividad;  
-// Cuenta segundos (aprox) sin actividad de usuario.
-// Se incrementa en la interrupcin de Timer0.
-// A los 10 s: se apaga la ?luz? (LATA3).
-// A los 20 s: se ejecuta Sleep() y luego se reinicia al despertar.
+// Cuenta segundos sin actividad de usuario.
+// Se incrementa en la ISR, cada MS_POR_SEGUNDO ticks de Timer2.
+// A los 10 s: AtiendeEventos() apaga la ?luz? (LATA3) con el EV_SEGUNDO.
+// A los SEGUNDOS_PARA_DORMIR (20 s): AdministraEnergia(), al final de cada vuelta
+// de main(), ejecuta Sleep() si no hay un lote en curso ni un guardado pendiente, y
+// lo vuelve a 0 al despertar. La ISR nunca ejecuta Sleep().
 
 // =========================== PROTOTIPOS DE FUNCIONES ===========================
 
-void __interrupt() ISR(void);          
-// Prototipo de la rutina de servicio de interrupciones.
+void __interrupt(high_priority) ISRParada(void);
+// Rutina de alta prioridad: solo la parada de emergencia por hardware (CCP1 en RC2).
+
+void __interrupt(low_priority) ISR(void);          
+// Prototipo de la rutina de servicio de interrupciones (baja prioridad).
 // Atiende:
-//  - Timer0 (parpadeo LED operacin, inactividad, Sleep).
-//  - Cambio en PORTB (teclado matricial).
+//  - Timer2 (tick de 1 ms: reloj del sistema, segundos, teclado y cola del LCD).
+//  - CCP2/Timer3 (captura de piezas en RC1).
 
 void ConfigVariables(void);          
 // Carga valores iniciales a TODAS las variables globales.
-// Se llama al inicio del main y tambin despus de cumplir la cuenta.
-
-void Bienvenida(void);                
-// Muestra la animacin y mensaje de bienvenida en el LCD.
-// Inicializa el LCD a 4 bits, crea el carcter Estrella y desplaza el texto.
-
-void PreguntaAlUsuario(void);    
-// Rutina que pregunta por el objetivo de piezas (01?59).
-// Se queda en un while interno hasta que el usuario ingrese un valor vlido y pulse 'OK'.
+// Se llama al inicio del main y también después de cumplir la cuenta.
 
 void ConfigPregunta(void);        
-// Rutina que arma el nmero de dos dgitos del objetivo a partir de teclas.
-// Se llama desde la ISR de PORTB cada vez que se presiona una tecla numrica 0?9
-// mientras modoEdicionObjetivo = 1.
+// Rutina que arma el número del objetivo (hasta DIGITOS_OBJETIVO cifras) a partir de teclas.
+// Se llama desde TeclaDigito() cada vez que se presiona una tecla numérica 0-9
+// en EST_OBJETIVO.
 
 void Borrar(void);                      
 // Borra el objetivo digitado por el usuario en el LCD y resetea piezasObjetivo.
-// Se llama desde la ISR cuando se presiona la tecla SUPR (RB7 en fila 3).
+// Se llama desde TeclaBorrar() cuando se presiona la tecla SUPR (RB7 en fila 3).
+
+void BorraUltimaCifra(void);
+// Quita solo la última cifra digitada (la de una tecla sostenida sin receta).
+
+void EscaneaTeclado(void);
+// Escaneo periódico del teclado matricial con antirrebote. Se llama desde la ISR.
+
+void PonEvento(unsigned char evento);
+// Agrega un evento a la cola. Se llama solo desde la ISR.
+
+void AtiendeEventos(void);
+// Despacha en main() los eventos que dejó la ISR (teclas, segundos, piezas).
+
+void DespachaUI(unsigned char evento);
+// Busca en transicionesUI[] la fila del estado y el evento y ejecuta su acción.
+
+void CambiaEstadoUI(unsigned char estado);
+// Pasa a otro estado y ejecuta su acción de entrada.
+
+void ArmaTemporizadorUI(unsigned int ms);
+// Genera EV_TIEMPO dentro de ms milisegundos (uno por estado).
+
+// Acciones de entrada y de cada vuelta de los estados (ver estadosUI[])
+void EntraBienvenida(void);
+void EntraObjetivo(void);
+void EntraError(void);
+void EntraLimites(void);
+void EntraConteo(void);
+void EntraCumplida(void);
+void EntraEmergencia(void);
+void PasoConteo(void);
+void MuestraLote(void);
+void DibujaConteo(void);
+void MuestraFaltantes(void);
+
+#ifdef MULTICARRIL
+void MuestreaCarriles(void);
+// Lee PORTC, filtra los 8 carriles a la vez y cuenta las subidas (desde la ISR).
+void EntraCarriles(void);
+void MuestraCarril(void);
+// Escribe en la pantalla virtual el conteo del carril carrilMostrado.
+void RotaCarril(void);
+// Cada segundo: actualiza el carril mostrado y pasa al siguiente cada SEGUNDOS_POR_CARRIL.
+unsigned char TeclaCarriles(void);
+unsigned char SalCarriles(void);
+#endif
+
+// Acciones de las transiciones: devuelven el estado siguiente (ver transicionesUI[])
+unsigned char PasoBienvenida(void);
+unsigned char SaltaBienvenida(void);
+unsigned char TeclaDigito(void);
+unsigned char TeclaReceta(void);
+unsigned char CargaReceta(void);
+unsigned char TeclaBorrar(void);
+unsigned char TeclaAceptar(void);
+unsigned char TeclaReinicio(void);
+unsigned char TeclaFin(void);
+unsigned char TeclaVista(void);
+unsigned char TeclaLuz(void);
+unsigned char TeclaEmergencia(void);
+unsigned char TeclaNuevoLote(void);
+unsigned char FinError(void);
+unsigned char FinLimites(void);
+unsigned char FinAvisoCumplido(void);
+unsigned char MetaAlcanzada(void);
+unsigned char IgnoraEvento(void);
+
+unsigned long DecrementaBCD(unsigned long bcd);
+// Resta 1 a un número en BCD empaquetado de 5 cifras (sin divisiones).
+
+void ActualizaSalidas(void);
+// Escribe el color de decenasRGB en LATE y unidades7Seg en LATD, juntos.
+
+void AdministraEnergia(void);
+// Pone a la CPU en reposo o en suspensión cuando no hay nada que atender.
+
+void FijaPerfilReloj(unsigned char perfil);
+// Cambia la frecuencia del oscilador y ajusta Timer2, la EUSART y los retardos.
+void AplicaPerfilReloj(unsigned char perfil);
+// Escribe los registros del perfil (desde la ISR, justo después de un tick de Timer2).
+
+unsigned int LeeMilisegundos(void);
+// Lee el reloj de milisegundos (16 bits, lo modifica la ISR) de forma atómica.
+
+void CalculaSalidas(unsigned int conteo);
+// Deja en unidades7Seg y decenasRGB lo que corresponde a un conteo dado.
+
+unsigned char LeeEEPROM(unsigned char direccion);
+// Lee un byte de la EEPROM de datos.
+
+void IniciaByteEEPROM(unsigned char direccion, unsigned char dato);
+// Arranca la escritura de un byte (no espera). Llamar con GIE en 0.
+
+void SolicitaGuardado(void);
+// Pide guardar el estado del lote en la EEPROM (se hace en AtiendePersistencia()).
+
+void AtiendePersistencia(void);
+// Arranca el guardado pedido si la EEPROM está libre. Se llama desde AtiendeEventos().
+
+unsigned char LeeReceta(unsigned char receta, unsigned int *objetivo);
+// Lee la receta 1-9. Devuelve sus lotes, o 0 si está vacía o dañada.
+
+void RecuperaEstado(void);
+// Busca en la EEPROM el registro más reciente y, si había un lote a medias, lo restaura.
+
+void EnviaTrama(unsigned char tipo, unsigned int a, unsigned int b);
+// Encola una trama de telemetría; si no cabe, la descarta y la cuenta en tramasPerdidas.
+
+void VaciaColaTX(void);
+// Espera a que todo lo encolado salga por la EUSART.
+
+#ifdef TRAZA_EVENTOS
+void VuelcaTraza(void);
+// Envía la traza de eventos como tramas TRAMA_TRAZA, del más viejo al más nuevo.
+#endif
+
+void ReiniciaRitmo(void);
+// Vacía la ventana de intervalos (al empezar un lote).
+
+void MuestraRitmo(void);
+// Calcula las piezas por minuto y las escribe en la segunda línea de la pantalla virtual.
+
+// ====================== TABLAS DE LA MÁQUINA DE ESTADOS ======================
+
+typedef struct{
+    void (*alEntrar)(void);
+    // Dibuja la pantalla del estado y prepara sus variables.
+    void (*enCadaVuelta)(void);
+    // Trabajo de cada vuelta del bucle principal, o 0 si el estado solo espera eventos.
+} EstadoUI;
+
+typedef struct{
+    unsigned char estado;
+    // EST_* o EST_CUALQUIERA.
+    unsigned char evento;
+    // Código de tecla (0-15), EV_TIEMPO, EV_META, EV_RECETA_LISTA, EV_DIGITO o EV_CUALQUIERA.
+    unsigned char (*accion)(void);
+    // Hace el trabajo de la transición y devuelve el estado siguiente.
+} TransicionUI;
+
+const EstadoUI estadosUI[TOTAL_ESTADOS_UI] = {
+    {EntraObjetivo,   0},              // EST_OBJETIVO
+    {EntraError,      0},              // EST_ERROR
+    {EntraLimites,    0},              // EST_LIMITES
+    {EntraConteo,     PasoConteo},     // EST_CONTEO
+    {EntraCumplida,   0},              // EST_CUMPLIDA
+    {EntraEmergencia, 0},              // EST_EMERGENCIA
+    {EntraBienvenida, 0},              // EST_BIENVENIDA
+#ifdef MULTICARRIL
+    {EntraCarriles,   0}               // EST_CARRILES
+#endif
+};
+
+const TransicionUI transicionesUI[] = {
+    {EST_EMERGENCIA, EV_CUALQUIERA,    IgnoraEvento},
+    // Después de la parada solo sirve el reset: esta fila va primero.
+    {EST_CUALQUIERA, TECLA_EMERGENCIA, TeclaEmergencia},
+    {EST_CUALQUIERA, TECLA_LUZ,        TeclaLuz},
+
+    {EST_BIENVENIDA, EV_TIEMPO,        PasoBienvenida},
+    {EST_BIENVENIDA, EV_CUALQUIERA,    SaltaBienvenida},
+    // Cualquier otra tecla termina la bienvenida.
+
+    {EST_OBJETIVO,   EV_DIGITO,        TeclaDigito},
+    {EST_OBJETIVO,   EV_RECETA,        TeclaReceta},
+    {EST_OBJETIVO,   EV_RECETA_LISTA,  CargaReceta},
+    {EST_OBJETIVO,   TECLA_SUPR,       TeclaBorrar},
+    {EST_OBJETIVO,   TECLA_OK,         TeclaAceptar},
+#ifdef MULTICARRIL
+    {EST_OBJETIVO,   TECLA_FIN,        TeclaCarriles},
+
+    {EST_CARRILES,   TECLA_OK,         SalCarriles},
+    {EST_CARRILES,   TECLA_FIN,        SalCarriles},
+#endif
+
+    {EST_ERROR,      EV_TIEMPO,        FinError},
+    {EST_LIMITES,    EV_TIEMPO,        FinLimites},
+
+    {EST_CONTEO,     TECLA_REINICIO,   TeclaReinicio},
+    {EST_CONTEO,     TECLA_FIN,        TeclaFin},
+    {EST_CONTEO,     TECLA_OK,         TeclaVista},
+    {EST_CONTEO,     EV_META,          MetaAlcanzada},
+    // Con lotes pendientes de la receta sigue en EST_CONTEO.
+
+    {EST_CUMPLIDA,   EV_TIEMPO,        FinAvisoCumplido},
+    {EST_CUMPLIDA,   TECLA_OK,         TeclaNuevoLote}
+};
 
 // ================================ PROGRAMA PRINCIPAL ================================
 
@@ -161,26 +1172,26 @@ void main (void){
     // 1. Inicializar variables globales
     ConfigVariables();
     // Se dejan todos los contadores y banderas en estado conocido (0 o inicial).
-    // pulsadorListo = 1, unidades7Seg = 0, piezasTotalesContadas = 0, etc.
+    // piezasPendientes = 0, unidades7Seg = 0, piezasTotalesContadas = 0, etc.
 
     modoEdicionObjetivo = 0;         
     // Al inicio no estamos editando el objetivo en el LCD.
 
-    // 2. Configuracin de puertos
+    // 2. Configuración de puertos
     ADCON1 = 0b001111;               
-    // Configura los pines analgicos como digitales en los puertos A, B y E
-    // segn la tabla de ADCON1 del 18F4550.
-    // Aqu se pretende dejar RA0?RA4, RB0?RB4 y RE0?RE2 como digitales,
+    // Configura los pines analógicos como digitales en los puertos A, B y E
+    // según la tabla de ADCON1 del 18F4550.
+    // Aquí se pretende dejar RA0?RA4, RB0?RB4 y RE0?RE2 como digitales,
     // para usarlos con el LCD, RGB, teclado, etc.
 
     // --- LED RGB (decenas) en Puerto E: RE0, RE1, RE2 ---
     TRISE = 0;                       
     // Pone todos los pines de PORTE como salidas digitales: RE0, RE1, RE2.
-    // Se usan para controlar el color del LED RGB segn decenasRGB.
+    // Se usan para controlar el color del LED RGB según decenasRGB.
 
     LATE  = 0b00000111;              
-    // Inicialmente pone 1 en RE0, RE1, RE2 (segn el hardware, lgica inversa).
-    // Se asume ?apagado?. Despus se sobreescribe
+    // Inicialmente pone 1 en RE0, RE1, RE2 (según el hardware, lógica inversa).
+    // Se asume ?apagado?. Después se sobreescribe
     // con los colores en el bucle de conteo.
 
     // --- Siete segmentos (unidades) en Puerto D ---
@@ -188,15 +1199,16 @@ void main (void){
     // Todos los pines de PORTD como salidas. Conectados a un decodificador BCD/7 segmentos
     // o directamente a segmentos.
 
-    LATD  = unidades7Seg;            
-    // Muestra en el puerto D el valor actual de unidades7Seg (al inicio ser 0).
-    // A medida que se incrementa unidades7Seg en el bucle de conteo, se actualiza LATD.
+    EscribeLATD_Bajo(unidades7Seg);
+    // Muestra en RD0-RD3 el valor actual de unidades7Seg (al inicio será 0).
+    // RD4-RD7 son del LCD: el programa solo cambia el nibble bajo, a través de la
+    // sombra de LATD de la librería, y nunca escribe LATD directamente.
 
-    // --- LED de operacin en RA1 ---
+    // --- LED de operación en RA1 ---
     TRISA1 = 0;                      
-    // Configura RA1 como salida digital. Se usa para el LED de ?operacin? (parpadeo).
+    // Configura RA1 como salida digital. Se usa para el LED de ?operación? (parpadeo).
     LATA1  = 0;                      
-    // LED apagado inicialmente. Luego parpadea en la ISR de Timer0.
+    // LED apagado inicialmente. Luego parpadea en la ISR, una vez por segundo.
 
     // --- Buzzer o segundo LED en RA2 ---
     TRISA2 = 0;                      
@@ -205,20 +1217,41 @@ void main (void){
     // - se cumple la meta (beep largo).
     LATA2  = 0;                      
 
-    // --- Pines para control del LCD (segn la librera) ---
+    // --- Pines para control del LCD (según la librería) ---
     TRISA3 = 0;                      
     // RA3 como salida
-    // Aqu RA3 se usa en la ISR para apagar/encender led de operacion.
+    // Aquí RA3 se usa en la ISR para apagar/encender led de operacion.
     LATA3  = 0;
 
     TRISA4 = 0;                      
-    // RA4 como salida digital. En la librera, RS se mapea a LATA4.
+    // RA4 como salida digital. En la librería, RS se mapea a LATA4.
     // Por tanto este pin es importante para distinguir comandos/datos hacia el LCD.
 
     // --- Pulsador / sensor de conteo en RC1 ---
     TRISC1 = 1;                      
-    // RC1 como entrada digital. Aqu conectas el pulsador o sensor que detecta la pieza.
-    // Se lee en el while de conteo para incrementar los contadores.
+    // RC1 como entrada digital. Aquí conectas el pulsador o sensor que detecta la pieza.
+    // También es la entrada CCP2 (CCP2MX=ON): el módulo de captura detecta cada flanco.
+
+    // --- Parada de emergencia por hardware en RC2 ---
+    TRISC2 = 1;
+    // RC2 como entrada: pulsador de parada a GND con pull-up externo (PORTC no tiene
+    // pull-ups internos). Es la entrada de CCP1, que captura el flanco de bajada.
+
+    // --- Telemetría: EUSART en RC6 (TX) y RC7 (RX) ---
+    TRISC6  = 0;
+    TRISC7  = 1;
+    // El módulo maneja los pines; TX como salida y RX como entrada (RX no se usa).
+    BAUDCON = 0b00001000;
+    // bit3 BRG16 = 1 ? generador de baudios de 16 bits.
+    SPBRGH  = 0;
+    SPBRG   = perfilSPBRG[PERFIL_LENTO];
+    // 9600 baudios con 1 MHz. FijaPerfilReloj() cambia SPBRG junto con el reloj.
+    TXSTA   = 0b00100100;
+    // bit5 TXEN = 1 ? transmisor encendido, bit4 SYNC = 0 ? asíncrono, bit2 BRGH = 1.
+    RCSTA   = 0b10000000;
+    // bit7 SPEN = 1 ? puerto serie habilitado (RC6/RC7 pasan a la EUSART).
+    TXIE    = 0;
+    // La interrupción de transmisión se habilita solo cuando hay bytes en la cola.
 
     // --- Backlight del LCD en RA5 ---
     TRISA5  = 0;                     
@@ -226,31 +1259,10 @@ void main (void){
     LATA5   = 1;                     
     // Enciende el backlight al inicio.
 
-    // ===================== CONFIGURACIN DE INTERRUPCIONES =====================
-
-    // --- TIMER0: parpadeo del LED de operacin ---
-    T0CON  = 0b00000001;             
-    // Configura Timer0:
-    // bit7 TMR0ON = 0 (todava apagado, aunque luego se pone en 1)
-    // bit6 T08BIT = 0 ? modo 16 bits
-    // bit5 T0CS   = 0 ? usa reloj interno (Fosc/4)
-    // bit4 T0SE   = 0 ? flanco de subida (no aplica en reloj interno)
-    // bit3 PSA    = 0 ? el prescaler est asignado a Timer0
-    // bits2-0 T0PS = 001 ? prescaler 1:4
-    // Con esto se calcula el tiempo de interrupcin usando la precarga 3036.
-
-    TMR0   = 3036;                   
-    // Precarga inicial para que Timer0 desborde aproximadamente cada 1 segundo.
-    // Cuando desborda, se activa TMR0IF y se atiende en la ISR.
+    // ===================== CONFIGURACIÓN DE INTERRUPCIONES =====================
 
-    TMR0IF = 0;                      
-    // Limpia la bandera de interrupcin de Timer0 (por si estaba en 1 al arranque).
-
-    TMR0IE = 1;                      
-    // Habilita la interrupcin local de Timer0 (perifrico TMR0).
-
-    TMR0ON = 1;                      
-    // Enciende Timer0. A partir de aqu empieza a contar.
+    // Timer0 ya no se usa: el segundo (parpadeo del LED de operación e inactividad)
+    // sale del tick de 1 ms de Timer2, que se recarga por hardware (ver más abajo).
 
     // --- TECLADO MATRICIAL en PORTB ---
     TRISB = 0b11110000;              
@@ -259,462 +1271,1295 @@ void main (void){
     // RB4?RB7 = 1 ? entradas (columnas del teclado).
 
     LATB  = 0b00000000;              
-    // Deja inicialmente las filas en 0. Se irn activando una a una en la ISR.
+    // Deja las filas en 0. El escaneo las activa una a una cada 5 ms y al terminar
+    // las vuelve a dejar en 0, para que cualquier tecla pueda despertar al PIC.
 
     RBPU  = 0;                       
     // Habilita los pull-up internos en RB4?RB7 (cuando se configuran como entradas).
-    // Esto asegura que las columnas estn en '1' cuando ninguna tecla est presionada.
+    // Esto asegura que las columnas estén en '1' cuando ninguna tecla está presionada.
 
-    __delay_ms(100);                 
-    // Pequeo retardo para que se estabilicen las entradas del teclado al inicio.
+    // No hace falta esperar a que se estabilicen las columnas: el antirrebote del
+    // escaneo exige 4 muestras iguales antes de aceptar cualquier tecla.
 
     RBIF  = 0;                       
-    // Limpia la bandera de interrupcin por cambio en PORTB.
-    // Esta bandera se usa para detectar cundo cambia alguna columna (se presiona una tecla).
-
-    RBIE  = 1;                       
-    // Habilita la interrupcin por cambio en RB4?RB7 (teclado matricial).
-
-    // --- Habilitacin global de interrupciones ---
+    RBIE  = 0;
+    // El teclado ya no usa la interrupción por cambio en RB4?RB7: lo escanea el tick
+    // de Timer2. RBIE solo se habilita un momento antes de Sleep() para despertar.
+
+    teclaSostenida  = SIN_TECLA;
+    // Ninguna tecla sostenida al arrancar.
+
+    contadorTeclas0 = 0xFFFF;
+    contadorTeclas1 = 0xFFFF;
+    // Contadores verticales en reposo: una tecla necesita 4 muestras seguidas para cambiar.
+
+#ifdef MULTICARRIL
+    // --- Sensores de los carriles en PORTC ---
+    TRISC |= CARRILES_ACTIVOS;
+    // Todos los carriles como entradas (RC1 ya lo es).
+    estadoCarriles    = PORTC & CARRILES_ACTIVOS;
+    contadorCarriles0 = 0xFF;
+    contadorCarriles1 = 0xFF;
+    // Arranca con el nivel actual de cada sensor: encender con un sensor en alto
+    // no cuenta como pieza.
+    while((CARRILES_ACTIVOS & (1u << carrilMostrado)) == 0){
+        carrilMostrado++;
+    }
+    // La vista de carriles empieza por el primero que tiene sensor.
+#endif
+
+    // --- TIMER3 + CCP2: captura por hardware de las piezas en RC1 ---
+    T3CON = 0b11111001;
+    // Configura Timer3 como base de tiempo libre para la captura:
+    // bit7 RD16     = 1 ? lectura/escritura de 16 bits en una sola operación
+    // bit6 T3CCP2   = 1 ? Timer3 es la base de CCP2 (piezas) y de CCP1 (parada)
+    // bits5-4 T3CKPS = 11 ? prescaler 1:8 ? 31.25 kHz a 1 MHz (32 us por tick, vuelta
+    //                  cada 2.1 s); a 8 MHz 4 us por tick y vuelta cada 262 ms
+    // bit1 TMR3CS   = 0 ? reloj interno (Fosc/4)
+    // bit0 TMR3ON   = 1 ? Timer3 encendido
+
+    CCP2CON = 0b00000101;
+    // CCP2 en modo captura, cada flanco de subida en RC1.
+    // El pulsador/sensor es activo en bajo: la subida marca el fin de la pieza,
+    // igual que hacía el antiguo antirrebote por software (espera de RC1 == 1).
+
+    CCP2IF = 0;
+    CCP2IE = 1;
+    // Limpia y habilita la interrupción de captura. La ISR solo suma la pieza y guarda la marca.
+
+    TMR3IF = 0;
+    TMR3IE = 1;
+    // Interrupción de desborde de Timer3: marca que la resta entre capturas ya no es válida.
+
+    // --- CCP1: parada de emergencia por hardware en RC2 ---
+    CCP1CON = 0b00000100;
+    // CCP1 en modo captura, cada flanco de bajada en RC2 (pulsador presionado).
+    // La captura guarda en CCPR1 la hora del flanco para medir la latencia de la parada.
+
+    CCP1IF = 0;
+    CCP1IE = 1;
+    // Es la única interrupción de alta prioridad (ver prioridades más abajo).
+
+    // --- TIMER2: tick de 1 ms para vaciar la cola del LCD ---
+    T2CON = 0b00000100;
+    // bits6-3 T2OUTPS = 0000 ? postscaler 1:1
+    // bit2    TMR2ON  = 1    ? Timer2 encendido
+    // bits1-0 T2CKPS  = 00   ? prescaler 1:1 (Fosc/4 = 250 kHz)
+    // (perfil lento; en el rápido cambian prescaler y postscaler, ver perfilT2CON).
+
+    PR2 = 249;
+    // Timer2 cuenta de 0 a 249 y vuelve a 0 por hardware: 250 ciclos = 1 ms exacto.
+
+    TMR2IF = 0;
+    TMR2IE = 1;
+    // En cada tick la ISR llama a AtiendeLCD(), que envía al LCD un byte de la cola.
+    // Así las funciones del LCD ya no bloquean el programa con retardos de 15 ms.
+
+#ifdef MEDIR_CICLOS
+    // --- TIMER1: contador de ciclos para el banco de pruebas ---
+    T1CON = 0b10000001;
+    // RD16 = 1, prescaler 1:1, reloj interno (Fosc/4), encendido: un tick por ciclo.
+#endif
+
+    // --- EEPROM de datos y detector de caída de tensión (HLVD) ---
+    EEIF = 0;
+    EEIE = 1;
+    // Fin de escritura de cada byte: la ISR arranca el siguiente byte del registro.
+
+    HLVDCON = 0b00011110;
+    // bit7 VDIRMAG = 0    ? avisa cuando VDD baja del umbral
+    // bit4 HLVDEN  = 1    ? módulo encendido
+    // bits3-0 HLVDL = 1110 ? el umbral interno más alto (por debajo de 5 V y sobre el BOR)
+    while(IRVST == 0){}
+    // Espera a que la referencia interna sea estable antes de habilitar la interrupción.
+    HLVDIF = 0;
+    HLVDIE = 1;
+    // Si la alimentación empieza a caer se guarda el estado de inmediato.
+
+    // --- Perfil de reloj inicial ---
+    FijaPerfilReloj(PERFIL_LENTO);
+    // 1 MHz, igual que al salir del reset. Deja listos T2CON y piezaMinTicks.
+
+    // --- Prioridades de interrupción ---
+    IPR1   = 0;
+    IPR2   = 0;
+    RBIP   = 0;
+    // Al salir del reset todas las fuentes son de alta prioridad: se pasan a baja.
+    CCP1IP = 1;
+    // Solo la parada de emergencia usa el vector de alta prioridad (0x0008).
+    IPEN   = 1;
+    // Habilita los dos niveles: ISRParada() interrumpe incluso a ISR().
+
+    // --- Habilitación global de interrupciones ---
     PEIE = 1;                        
-    // Habilita interrupciones de perifricos (Timer0, PORTB, etc.).
+    // Con IPEN = 1 es GIEL: habilita las interrupciones de baja prioridad (Timer2, CCP2, etc.).
 
     GIE  = 1;                        
-    // Habilitacin global de interrupciones. A partir de aqu, las interrupciones estn activas.
+    // Con IPEN = 1 es GIEH: habilita la de alta prioridad y, con GIEL, todas las demás.
+    // GIE = 0 en main() sigue bloqueando las dos; las secciones críticas que solo
+    // comparten datos con ISR() apagan solo GIEL para no retrasar la parada.
 
     // ============================= INICIO DEL PROGRAMA =============================
 
-    Bienvenida();                    
-    // Llama a la funcin que:
-    //  - Configura el LCD a 4 bits (ConfiguraLCD(4), InicializaLCD()).
-    //  - Crea el carcter Estrella en CGRAM (CrearCaracter(Estrella,0)).
-    //  - Muestra el mensaje de bienvenida con estrellas alrededor.
-    //  - Desplaza el texto con DesplazaPantallaD() para dar animacin.
+    // Desde aquí la captura de RC1 ya cuenta: las piezas quedan en piezasPendientes
+    // aunque main() todavía no haya llegado al bucle principal.
+
+    RecuperaEstado();
+    // Si se apagó (o hubo parada de emergencia) con un lote a medias, vuelve el
+    // objetivo y las piezas ya contadas.
+
+    ConfiguraLCD(4);
+    InicializaLCD();
+    OcultarCursor();
+    // LCD a 4 bits. La secuencia de inicialización (más de 60 ms con sus esperas)
+    // solo se encola: la envía el tick de Timer2 mientras main() sigue.
+
+    CambiaEstadoUI(loteRecuperado == 1 ? EST_CONTEO : EST_BIENVENIDA);
+    loteRecuperado = 0;
+    // Un lote recuperado de la EEPROM sigue contando de inmediato, sin bienvenida
+    // y sin descartar las piezas que pasaron durante el arranque. Si no, la
+    // bienvenida corre como un estado más y cualquier tecla la salta.
 
     while(1){
-        // Bucle infinito principal del programa.
-
-        // 1. Preguntar el nmero de piezas a contar (01 a 59)
-        PreguntaAlUsuario();
-        // Aqu se entra en un while interno que:
-        //  - Dibuja el marco (CrearCaracter(Marco,1)).
-        //  - Pide "Piezas a contar:".
-        //  - Espera que el usuario digite dos dgitos (ConfigPregunta(), desde la ISR).
-        //  - Valida que el nmero est entre 1 y 59.
-        //  - Sale solo cuando hay un objetivo vlido y se presiona 'OK'.
-
-        OcultarCursor();
-        // Despus de aceptar el objetivo, ya no queremos el cursor parpadeando en esa zona.
-
-        // 2. Mostrar estado inicial en LCD: faltantes y objetivo
-        MensajeLCD_Var("Faltantes: ");
-        // Imprime la palabra "Faltantes: " en la primera lnea.
-
-        EscribeLCD_n8(piezasObjetivo - piezasTotalesContadas, 2);
-        // Muestra cuntas piezas faltan para llegar al objetivo (2 dgitos).
-        // Al inicio, piezasTotalesContadas = 0, as que muestra el objetivo completo.
-
-        DireccionaLCD(0xC0);
-        // Mueve el cursor al inicio de la segunda lnea (direccin 0xC0).
-
-        MensajeLCD_Var("Objetivo: ");
-        // Imprime "Objetivo: " en la segunda lnea.
-
-        EscribeLCD_n8(piezasObjetivo, 2);
-        // Escribe el nmero del objetivo (2 dgitos) a la derecha de "Objetivo:".
-
-        flagConteoActivo = 1;        
-        // Marca que estamos entrando al ciclo de conteo.
-        // Esto habilita el while interno que maneja el conteo de piezas.
-
-        // ========================= BUCLE PRINCIPAL DE CONTEO =========================
-        while (flagConteoActivo == 1){
-
-            // Caso: se lleg al objetivo de piezas
-            if(piezasTotalesContadas == piezasObjetivo){
-
-                // Aviso con RA2 (buzzer o LED) - seal de objetivo cumplido
-                LATA2 = 1;
-                __delay_ms(1000);
-                LATA2 = 0;
-
-                // Mensaje en pantalla de cuenta cumplida
-                BorraLCD();
-                MensajeLCD_Var("Cuenta Cumplida");
-                DireccionaLCD(0xC4);
-                MensajeLCD_Var("Presione OK");
-
-                // Salir del ciclo de conteo
-                flagConteoActivo = 0;
-                teclaLeida       = '\0';
-                // Se pone la bandera en 0 para romper el while interno,
-                // y se limpia teclaLeida para esperar el 'OK'.
-
-                // Esperar hasta que se pulse la tecla OK ('*')
-                while(teclaLeida != '*'){}
-                // Aqu no se lee el teclado en polling; la tecla se actualiza en la ISR de PORTB.
-                // Cuando el usuario presione 'OK', en la interrupcin se har teclaLeida = '*'
-                // y se romper este while.
-
-                // Volver a valores iniciales
-                ConfigVariables();
-                // Resetea todos los contadores, banderas y estado interno para iniciar de nuevo.
+        // Bucle infinito principal: nunca espera dentro de un estado. Cada vuelta
+        // reparte los eventos, hace el trabajo periódico del estado y duerme.
+
+        INICIO_CICLOS(MED_CICLO_PRINCIPAL);
+
+        AtiendeEventos();
+        // Teclas (pasan por DespachaUI()), segundos y guardados en la EEPROM.
+
+        if(duracionTemporizadorUI != 0 &&
+           (unsigned int)(LeeMilisegundos() - inicioTemporizadorUI) >= duracionTemporizadorUI){
+            duracionTemporizadorUI = 0;
+            DespachaUI(EV_TIEMPO);
+        }
+        // Temporizador del estado (mensajes de error, aviso de cuenta cumplida).
+
+        if(estadosUI[estadoUI].enCadaVuelta != 0){
+            estadosUI[estadoUI].enCadaVuelta();
+        }
+        // En EST_CONTEO toma las piezas que capturó la ISR.
+
+        RefrescaLCD();
+        // Encola solo las celdas que cambiaron (normalmente una dirección y uno o dos datos).
+
+        if(midiendoBytesFaltantes == 1){
+            midiendoBytesFaltantes = 0;
+            bytesFaltantes = bytesRefrescoLCD;
+            if(bytesFaltantes > bytesMaxFaltantes){
+                bytesMaxFaltantes = bytesFaltantes;
             }
+        }
+        // Costo en bytes de cada actualización de faltantes (banco de pruebas).
+
+        FIN_CICLOS(MED_CICLO_PRINCIPAL);
+
+        AdministraEnergia();
+        // Sin piezas ni eventos pendientes la CPU descansa hasta la próxima interrupción
+        // (flanco en RC1, tick de 1 ms, tecla, ...). Los periféricos siguen contando.
+    }
+}
+
+// ======================= RUTINA DE SERVICIO DE INTERRUPCIÓN =======================
 
-            // Deteccin del pulsador/sensor en RC1 (activo en bajo)
-            if(RC1 == 0 && piezasTotalesContadas != piezasObjetivo){
-                // Si el pulsador est presionado (0 lgico) y todava no hemos llegado al objetivo:
-                segundosSinActividad = 0;  
-                // Se reinicia el contador de inactividad para que no entre en Sleep.
+void __interrupt(high_priority) ISRParada(void){
+    // Flanco de bajada en RC2: salidas seguras antes que cualquier otra cosa.
+    // No llama a funciones ni toca colas compartidas con ISR(): así el compilador
+    // guarda el contexto en los registros sombra y la respuesta queda acotada.
+    LATE    = 0b00000011;
+    // RGB en rojo (lógica inversa).
+    CCP2CON = 0;
+    // Apaga la captura de piezas en RC1.
 
-                pulsadorListo        = 0;  
-                // Se prepara para detectar el flanco de subida (cuando RC1 vuelva a 1).
-                // Esto evita que cuente muchas veces mientras el botn est sostenido.
+    latenciaParada = (unsigned int)(TMR3 - CCPR1) << 3;
+    if(latenciaParada > latenciaParadaMax){
+        latenciaParadaMax = latenciaParada;
+    }
+    // Del flanco a las salidas: entrada al vector (3-4 ciclos) más la sección crítica
+    // con GIE = 0 más larga que estuviera corriendo en main() o en ISR(). El escenario
+    // estres_parada la mide con la EEPROM, la cola del LCD y el segundo a la vez.
+
+    CCP1IE = 0;
+    CCP1IF = 0;
+    // Una parada basta: los rebotes del pulsador no vuelven a entrar.
+    paradaPendiente = 1;
+    // main() pasa a EST_EMERGENCIA en AtiendeEventos() (pantalla, telemetría y EEPROM).
+}
+
+void __interrupt(low_priority) ISR(void){
+    INICIO_CICLOS(MED_ISR);
+    inicioISR = TMR3;
+    // Marca de entrada para medir la duración de la ISR (ver ciclosMaxISR).
+
+    // Esta función atiende todas las interrupciones habilitadas:
+    //  - CCP2 (captura de piezas en RC1) y desborde de Timer3.
+    //  - TMR2 (tick de 1 ms que alimenta el LCD).
+
+    // -------------------- CAPTURA CCP2 (PIEZA EN RC1) --------------------
+    if(CCP2IF == 1){
+        // Entra aquí en cada flanco de subida de RC1. El valor de Timer3 en ese
+        // instante ya quedó guardado por hardware en CCPR2.
+
+        CCP2IF = 0;
+
+        latenciaPieza = (unsigned int)(TMR3 - CCPR2) << 3;
+        if(latenciaPieza > latenciaPiezaMax[perfilReloj]){
+            latenciaPiezaMax[perfilReloj] = latenciaPieza;
+        }
+        // Flanco a ISR, por perfil (ver latenciaPiezaMax).
+
+        if(TMR3IF == 1 && CCPR2 < 0x8000){
+            TMR3IF = 0;
+            if(desbordesTimer3 < 2){
+                desbordesTimer3++;
             }
+            // Timer3 dio la vuelta antes de esta captura (CCPR2 quedó cerca de 0) y la
+            // ISR todavía no la había contado: se cuenta antes de comparar.
+        }
 
-            // Lgica de antirrebote: esperar a que RC1 vuelva a 1
-            if(pulsadorListo == 0){
-                // Solo entra aqu si ya detectamos una bajada (RC1 == 0 antes).
-
-                if(RC1 == 1){
-                    // Cuando vuelve a 1, interpretamos que hubo un pulso vlido de conteo.
-
-                    pulsadorListo = 1;     
-                    // Se bloquea hasta que haya otra nueva bajada en RC1.
-
-                    // Actualizar contadores
-                    unidades7Seg++;        
-                    // Aumenta las unidades (para el display de 7 segmentos).
-
-                    piezasTotalesContadas++; 
-                    // Aumenta el total de piezas.
-
-                    // Cuando se llega a 10 unidades, se suma una decena
-                    if (unidades7Seg == 10){
-
-                        // Aviso corto con RA2: beep para indicar que se complet una decena
-                        LATA2 = 1;
-                        __delay_ms(300);
-                        LATA2 = 0;
-
-                        unidades7Seg = 0;  
-                        // Reinicia unidades de 0 a 9
-
-                        decenasRGB++;      
-                        // Incrementa el contador de decenas, que luego se refleja en el color del RGB.
-
-                        if (decenasRGB == 6){ 
-                            // Si llega a 6 decenas (60 piezas), se reinicia a 0.
-                            // Esto porque solo se permiten objetivos hasta 59.
-                            decenasRGB = 0;
-                        }
-                    }
-
-                    // Actualizacin de color del LED RGB segn las decenas
-                    if(decenasRGB == 0){
-                        LATE = 0b00000001; // Magenta (Rojo+Azul) segn tu conexin.
-                    }else if(decenasRGB == 1){
-                        LATE = 0b00000101; // Azul
-                    }else if(decenasRGB == 2){
-                        LATE = 0b00000100; // Cyan
-                    }else if(decenasRGB == 3){
-                        LATE = 0b00000110; // Verde
-                    }else if(decenasRGB == 4){
-                        LATE = 0b00000010; // Amarillo
-                    }else if(decenasRGB == 5){
-                        LATE = 0b00000000; // Blanco
-                    }
-
-                    // Actualizar faltantes en el LCD
-                    DireccionaLCD(0x8B);
-                    // Posiciona el cursor justo donde se imprimen los ?faltantes?
-                    // dentro de la primera lnea.
-
-                    EscribeLCD_n8(piezasObjetivo - piezasTotalesContadas, 2);
-                    // Escribe de nuevo cuntas piezas faltan (2 dgitos).
-
-                    // Actualizar siete segmentos (unidades)
-                    LATD = unidades7Seg;
-                    // Refresca el valor en el display de 7 segmentos con las unidades actuales.
-
-                    __delay_ms(500);       
-                    // Retardo adicional para antirrebote y para que el conteo no sea demasiado rpido.
+        if(desbordesTimer3 >= 2 ||
+           (desbordesTimer3 == 1 && CCPR2 >= ultimaCaptura) ||
+           (unsigned int)(CCPR2 - ultimaCaptura) >= piezaMinTicks){
+            // Flanco suficientemente separado del anterior ? es una pieza nueva.
+            if(piezasPendientes == 0){
+                PonEvento(EV_PIEZA);
+                // Solo se avisa la primera pieza de cada tanda: el conteo real está
+                // en piezasPendientes y nunca se pierde aunque la cola esté llena.
+            }
+            piezasPendientes++;
+            ultimaCaptura   = CCPR2;
+            desbordesTimer3 = 0;
+
+            if(hayPiezaPrevia == 1){
+                sumaIntervalos -= intervalosPieza[indiceIntervalo];
+                intervalosPieza[indiceIntervalo] = milisegundos - ultimaPiezaMs;
+                sumaIntervalos += intervalosPieza[indiceIntervalo];
+                indiceIntervalo = (indiceIntervalo + 1) & (TAM_VENTANA_RITMO - 1);
+                if(totalIntervalos < TAM_VENTANA_RITMO){
+                    totalIntervalos++;
                 }
             }
+            ultimaPiezaMs  = milisegundos;
+            hayPiezaPrevia = 1;
+            // Medidor de ritmo: el intervalo nuevo reemplaza al más viejo en la ventana
+            // y en la suma (unas pocas sumas, sin recorrer la ventana ni dividir).
         }
+        else{
+            flancosRechazados++;
+            // Si no, es un rebote del pulsador y se descarta.
+        }
+        // Nada más: main() reconcilia contadores y pantallas a partir de piezasPendientes.
+    }
 
-        // Al salir del ciclo (cuando flagConteoActivo pasa a 0), fijar estado del RGB y siete segmentos
-        LATE = 0b00000001;                 
-        // Deja el RGB en Magenta como estado de ?reposo?.
-
-        LATD = unidades7Seg;               
-        // Muestra el ltimo valor contado en el 7 segmentos (por si se vuelve a mostrar).
+    // -------------------- DESBORDE DE TIMER3 --------------------
+    if(TMR3IF == 1){
+        TMR3IF         = 0;
+        if(desbordesTimer3 < 2){
+            desbordesTimer3++;
+        }
+        // Una vuelta más desde la última pieza (cada 2.1 s en PERFIL_LENTO y cada
+        // 262 ms en PERFIL_RAPIDO). Un rebote justo después de la vuelta sigue filtrado.
     }
-}
 
-// ======================= RUTINA DE SERVICIO DE INTERRUPCIN =======================
+    // -------------------- TICK DE 1 ms (TIMER2): COLA DEL LCD --------------------
+    if(TMR2IF == 1){
+        TMR2IF = 0;
+        if(perfilPedido != SIN_PERFIL_PEDIDO){
+            AplicaPerfilReloj(perfilPedido);
+            perfilPedido = SIN_PERFIL_PEDIDO;
+            // Recién desbordó Timer2: T2CON se cambia con el tick nuevo recién empezado
+            // y ningún tick queda medido con dos frecuencias.
+        }
 
-void __interrupt() ISR(void){
-    // Esta funcin atiende todas las interrupciones habilitadas:
-    //  - TMR0 (parpadeo, inactividad y Sleep).
-    //  - PORTB (teclado matricial).
+        milisegundos++;
+        // Reloj de milisegundos.
 
-    // -------------------- INTERRUPCIN POR TIMER0 (LED OPERACIN) --------------------
-    if(TMR0IF == 1){
-        // Entra aqu cuando Timer0 desborda (overflow).
+        divisorTeclado++;
+        if(divisorTeclado == TECLADO_PERIODO_MS){
+            divisorTeclado = 0;
+            EscaneaTeclado();
+            // Cada 5 ms: lee las 16 teclas, filtra rebotes y genera eventos.
+        }
+
+#ifdef MULTICARRIL
+        MuestreaCarriles();
+        // Cada 1 ms: los 8 carriles de PORTC en un solo muestreo.
+#endif
 
-        TMR0   = 3036;                    
-        // Recarga el valor inicial para volver a generar otro periodo de ~1 segundo.
+        AtiendeLCD();
+        // Envía como máximo un byte pendiente al LCD respetando sus tiempos.
 
-        TMR0IF = 0;                       
-        // Limpia la bandera para poder detectar la prxima interrupcin.
+        divisorSegundo++;
+        if(divisorSegundo == MS_POR_SEGUNDO){
+            divisorSegundo = 0;
+            segundosSistema++;
 
-        LATA1  = LATA1 ^ 1;               
-        // Conmuta el estado del LED en RA1 usando XOR:
-        //  - Si estaba en 0, pasa a 1.
-        //  - Si estaba en 1, pasa a 0.
-        // Resultado: LED de operacin parpadea cada segundo aprox.
+            LATA1 = LATA1 ^ 1;
+            // LED de operación: cambia cada segundo.
 
-        segundosSinActividad++;           
-        // Cada vez que se ejecuta esta ISR (1 vez por segundo), incrementa el contador
-        // de segundos sin actividad. Esta variable se reinicia a 0 cuando:
-        //  - Hay pulsos en RC1 (conteo de piezas).
-        //  - Hay tecleo en el teclado (se reasigna en ISR de PORTB).
+            segundosSinActividad++;
+            // Se reinicia a 0 con cada tecla o pieza y al despertar de Sleep.
 
-        // Apagar backlight a los 10 segundos de inactividad
-        if(segundosSinActividad == 10){
-            // Backlight = 0 (en comentario originalmente).
-            LATA3 = 0;                    
-            // Aqu RA3 se est usando para apagar algo (por ejemplo, la luz del LCD).
-            // Depende de tu hardware cmo est conectado.
+            PonEvento(EV_SEGUNDO);
+            // main() decide qué hacer con el segundo (por ejemplo, apagar la luz RA3
+            // a los 10 segundos de inactividad).
         }
+        // El segundo se cuenta en ticks de Timer2, no con otro timer recargado por
+        // software: aunque la ISR entre tarde, el tick siguiente llega a tiempo.
+    }
 
-        // Entrar en suspensin a los 20 segundos de inactividad
-        if(segundosSinActividad >= 20){
-            Sleep();                      
-            // Instruccin especial del PIC: entra en modo bajo consumo.
-            // El PIC se detiene hasta que haya una interrupcin que lo despierte
-            // (por ejemplo, un cambio en PORTB o interrupcin externa).
+    // -------------------- TRANSMISIÓN EUSART (TELEMETRÍA) --------------------
+    if(TXIE == 1 && TXIF == 1){
+        if(colaTXSalida != colaTXEntrada){
+            TXREG        = colaTX[colaTXSalida];
+            colaTXSalida = (colaTXSalida + 1) & (TAM_COLA_TX - 1);
+        }else{
+            TXIE = 0;
+            // Cola vacía: TXIF queda en 1 mientras TXREG esté libre, hay que deshabilitarla.
+        }
+    }
 
-            // ---- DESPUS DE DESPERTAR LLEGA AQU ----
-            segundosSinActividad = 0;     
-            // Al despertar, se reinicia el contador de inactividad.
+    // -------------------- FIN DE ESCRITURA EN EEPROM --------------------
+    if(EEIF == 1){
+        EEIF = 0;
+        bytesEEPROMPendientes--;
+        if(bytesEEPROMPendientes != 0){
+            direccionEEPROM++;
+            GIE = 0;
+            IniciaByteEEPROM(direccionEEPROM,
+                             registroEEPROM[TAM_REGISTRO_EEPROM - bytesEEPROMPendientes]);
+            GIE = 1;
+            // Arranca el siguiente byte del registro. Dentro de ISR() solo GIEL está en 0:
+            // se apaga también GIEH para que ISRParada() no corte la secuencia 0x55/0xAA.
+        }
+    }
 
-            RBIF = 0;                     
-            // Se limpia la bandera de interrupcin de PORTB (por si esa fue la causa del despertar).
+    // -------------------- CAÍDA DE TENSIÓN (HLVD) --------------------
+    if(HLVDIE == 1 && HLVDIF == 1){
+        HLVDIF       = 0;
+        HLVDIE       = 0;
+        caidaTension = 1;
+        // main() guarda el estado en la próxima vuelta (AtiendePersistencia()).
+        // Se avisa una sola vez: si VDD se queda bajo no se repiten los guardados.
+    }
 
-            TMR0ON = 1;                   
-            // Se asegura que Timer0 vuelva a estar encendido despus de Sleep.
+    // Medición de la duración de esta ISR (en ciclos de instrucción, resolución de 8)
+    duracionISR = (unsigned int)(TMR3 - inicioISR) << 3;
+    if(duracionISR > ciclosMaxISR){
+        ciclosMaxISR = duracionISR;
+    }
+    FIN_CICLOS(MED_ISR);
+}
+
+// ======================== FUNCIÓN: ESCANEAR TECLADO (DESDE LA ISR) ========================
+
+void EscaneaTeclado(void){
+    // Lee las 4 filas, aplica el antirrebote a las 16 teclas a la vez y pone en la
+    // cola los eventos de tecla presionada, soltada y sostenida.
+    unsigned int muestra = 0;
+    unsigned int cambio;
+    unsigned int presionadas;
+    unsigned int soltadas;
+    unsigned int mascara;
+    unsigned char bit;
+    unsigned char fila = 4;
+
+    // 1. Muestra cruda: bit en 1 ? tecla presionada (columna en 0 con su fila activa)
+    do{
+        fila--;
+        LATB = filasTeclado[fila];
+        NOP();
+        // Deja estabilizar la fila antes de leer las columnas.
+        muestra = (muestra << 4) | ((~PORTB >> 4) & 0x0F);
+        // De la última fila a la primera: cada fila corre 4 bits a las anteriores y
+        // la fila 0 queda en los bits 0-3. El PIC no tiene desplazamientos variables
+        // y << (fila * 4) costaba un bucle por fila.
+    }while(fila != 0);
+    LATB = 0b11110000;
+    // Filas de nuevo en 0 entre escaneos.
+
+    // 2. Antirrebote con contadores verticales de 2 bits (16 teclas en paralelo).
+    //    Una tecla cambia de estado solo tras 4 muestras seguidas distintas de su estado.
+    cambio          = estadoTeclas ^ muestra;
+    contadorTeclas0 = ~(contadorTeclas0 & cambio);
+    contadorTeclas1 = contadorTeclas0 ^ (contadorTeclas1 & cambio);
+    cambio         &= contadorTeclas0 & contadorTeclas1;
+    estadoTeclas   ^= cambio;
+    presionadas     = estadoTeclas & cambio;
+    soltadas        = ~estadoTeclas & cambio;
+
+    // 3. Eventos de tecla presionada / soltada (varias a la vez si hay rollover)
+    if(cambio != 0){
+        segundosSinActividad = 0;
+        // Hubo actividad del usuario ? se reinicia inactividad.
+
+        mascara = 1;
+        for(bit = 0; cambio != 0; bit++){
+            // cambio == presionadas | soltadas: termina con la última tecla que cambió
+            // y la máscara avanza un bit por vuelta en vez de calcular 1u << bit.
+            if(presionadas & mascara){
+                if(mapaTeclas[bit] == TECLA_EMERGENCIA){
+                    LATE    = 0b00000011;
+                    // PARADA DE EMERGENCIA desde el teclado (respaldo del pulsador en RC2,
+                    // que la atiende ISRParada()): RGB en rojo sin esperar a main().
+                    CCP2CON = 0;
+                    // Apaga el módulo de captura: deja de aceptar piezas.
+                }
+                PonEvento(mapaTeclas[bit]);
+                teclaSostenida    = bit;
+                escaneosSostenida = 0;
+            }
+            else if(soltadas & mascara){
+                PonEvento(EV_SUELTA | mapaTeclas[bit]);
+                if(teclaSostenida == bit){
+                    teclaSostenida = SIN_TECLA;
+                }
+            }
+            cambio  &= ~mascara;
+            mascara <<= 1;
         }
     }
 
-    // -------------------- INTERRUPCIN POR CAMBIO EN PORTB (TECLADO) ----------------
-    if(RBIF == 1){
-        // Entra aqu cuando hay un cambio en RB4?RB7 (teclado matricial).
+    // 4. Tecla sostenida: un solo EV_LARGA al cumplir el tiempo
+    if(teclaSostenida != SIN_TECLA){
+        escaneosSostenida++;
+        if(escaneosSostenida == TECLA_LARGA_ESCANEOS){
+            PonEvento(EV_LARGA | mapaTeclas[teclaSostenida]);
+            teclaSostenida = SIN_TECLA;
+        }
+    }
+}
 
-        if(PORTB != 0b11110000){          
-            // Se verifica que realmente haya una tecla presionada.
-            // Si todo est en '1' (1111 en columnas), no hay tecla.
+#ifdef MULTICARRIL
+// ======================== FUNCIÓN: MUESTREAR CARRILES (DESDE LA ISR) ========================
+
+void MuestreaCarriles(void){
+    // Un muestreo de PORTC para todos los carriles: el antirrebote y la detección
+    // de flancos son operaciones de 8 bits, así que cuestan lo mismo con 1 carril
+    // que con 8. Solo el conteo recorre los carriles, y solo los que tuvieron una
+    // subida en este milisegundo.
+    // Banco de pruebas: make carriles compara el tiempo de ISR por muestra con
+    // CARRILES_ACTIVOS = 0b00000010 y con 0b11111111 (escenario carriles_muestreo).
+    unsigned char cambio;
+    unsigned char subidas;
+    unsigned char carril;
+
+    INICIO_CICLOS(MED_CARRILES);
+
+    cambio            = estadoCarriles ^ (PORTC & CARRILES_ACTIVOS);
+    contadorCarriles0 = ~(contadorCarriles0 & cambio);
+    contadorCarriles1 = contadorCarriles0 ^ (contadorCarriles1 & cambio);
+    cambio           &= contadorCarriles0 & contadorCarriles1;
+    estadoCarriles   ^= cambio;
+    subidas           = estadoCarriles & cambio;
+    // Mismo antirrebote que EscaneaTeclado(), en 8 bits: un carril cambia tras 4
+    // muestras seguidas distintas de su estado. Las subidas son los bits que
+    // cambiaron y quedaron en 1.
+
+    if(subidas != 0){
+        segundosSinActividad = 0;
+        // Hay piezas pasando: el PIC no se suspende.
+    }
 
-            segundosSinActividad = 0;     
-            // Hubo actividad del usuario ? se reinicia inactividad.
+    for(carril = 0; subidas != 0; carril++){
+        if(subidas & 1){
+            conteoCarril[carril]++;
+            if(conteoCarril[carril] == metaCarril[carril]){
+                conteoCarril[carril] = 0;
+                lotesCarril[carril]++;
+            }
+            // Meta cumplida: el carril vuelve a empezar solo.
+        }
+        subidas >>= 1;
+    }
 
-            LATB = 0b11111110;            
-            // Se activa la fila 1 (RB0 = 0) y se dejan RB1?RB3 en 1.
-            // As se puede leer qu columna (RB4?RB7) est en 0 para detectar la tecla.
+    FIN_CICLOS(MED_CARRILES);
+}
+
+#endif
+
+// ======================== FUNCIÓN: PONER EVENTO (DESDE LA ISR) ========================
+
+void PonEvento(unsigned char evento){
+    // Guarda un evento en la cola. Solo la ISR escribe colaEventosEntrada y solo
+    // main() escribe colaEventosSalida, así que no hace falta deshabilitar interrupciones.
+    unsigned char siguiente;
+
+    siguiente = (colaEventosEntrada + 1) & (TAM_COLA_EVENTOS - 1);
+    if(siguiente == colaEventosSalida){
+        eventosPerdidos++;
+        // Cola llena: se descarta el evento y se deja constancia.
+        return;
+    }
+    colaEventos[colaEventosEntrada] = evento;
+    colaEventosEntrada = siguiente;
+}
+
+// ======================== FUNCIÓN: ATENDER EVENTOS (DESDE MAIN) ========================
+
+void AtiendeEventos(void){
+    // Despachador cooperativo: saca de la cola todos los eventos que dejó la ISR
+    // y los procesa en el contexto de main(). Se llama en cada vuelta del bucle principal.
+    unsigned char evento;
+
+    if(paradaPendiente == 1){
+        paradaPendiente = 0;
+        DespachaUI(TECLA_EMERGENCIA);
+    }
+    // La parada por RC2 no usa la cola: ISRParada() no puede tocarla a mitad de un PonEvento().
+
+    while(colaEventosSalida != colaEventosEntrada){
+        evento = colaEventos[colaEventosSalida];
+        colaEventosSalida = (colaEventosSalida + 1) & (TAM_COLA_EVENTOS - 1);
+
+        if(evento < EV_SEGUNDO){
+            EnviaTrama(TRAMA_TECLA, LeeMilisegundos(), evento);
+        }
+        // Toda tecla (presionada, soltada o larga) sale por la telemetría.
 
-            // -------- FILA 1 (RB0 activa) --------
-            if(RB4 == 0){                 
-                // Columna RB4 en 0 con fila 1 activa ? tecla '1'.
-                teclaLeida = 1;
-                ConfigPregunta();
-                // Llama a ConfigPregunta() para construir el nmero del objetivo
-                // si estamos en modoEdicionObjetivo.
-            }            
-            else if(RB5 == 0){            
-                // Tecla '2'
-                teclaLeida = 2; 
-                ConfigPregunta();
+        if(evento == EV_SEGUNDO){
+            if(flagConteoActivo == 1){
+                MuestraRitmo();
             }
-            else if(RB6 == 0){            
-                // Tecla '3'
-                teclaLeida = 3; 
-                ConfigPregunta();
+            // El ritmo se recalcula una vez por segundo, no en cada pieza.
+
+#ifdef MULTICARRIL
+            if(estadoUI == EST_CARRILES){
+                RotaCarril();
+            }
+            // Los carriles se muestran por turnos.
+#endif
+
+            porcentajeReposo = (unsigned char)((ticksReposo * 100UL) / (TICKS_TMR3_1MHZ * multiplicadorReloj));
+            ticksReposo      = 0;
+            // Parte del último segundo que la CPU pasó detenida en ENERGIA_REPOSO.
+
+            if(segundosSinGuardar != 255){
+                segundosSinGuardar++;
             }
-            else if(RB7 == 0){            
-                // Tecla OK ('*')
-                teclaLeida = '*'; 
-                // No llama a ConfigPregunta() porque esta tecla confirma la entrada.
-                // Se usa en:
-                //  - PreguntaAlUsuario(): para salir del while que espera '*'.
-                //  - Despus de "Cuenta Cumplida": para continuar.
+            if(piezasSinGuardar != 0 && segundosSinGuardar >= SEGUNDOS_ENTRE_GUARDADOS){
+                SolicitaGuardado();
             }
+            // Guardado periódico del conteo: a lo sumo uno por intervalo, con cualquier ritmo.
 
-            // -------- FILA 2 (RB1 activa) --------
-            else{
-                LATB = 0b11111101;        
-                // Activa fila 2 (RB1 = 0).
+            if(tramasPerdidas != tramasPerdidasAvisadas){
+                tramasPerdidasAvisadas = tramasPerdidas;
+                EnviaTrama(TRAMA_PERDIDAS, LeeMilisegundos(), tramasPerdidas);
+            }
+            // Si se perdieron tramas se avisa (como mucho una vez por segundo).
 
-                if(RB4 == 0){             
-                    // Tecla '4'
-                    teclaLeida = 4;
-                    ConfigPregunta();
-                }
-                else if(RB5 == 0){        
-                    // Tecla '5'
-                    teclaLeida = 5; 
-                    ConfigPregunta();
-                }
-                else if(RB6 == 0){        
-                    // Tecla '6'
-                    teclaLeida = 6; 
-                    ConfigPregunta();
-                }
-                else if(RB7 == 0){        
-                    // Tecla de PARADA DE EMERGENCIA.
-                    // Usada para detener totalmente el sistema.
+            // Apagar la luz (RA3) a los 10 segundos de inactividad
+            if(segundosSinActividad == 10){
+                LATA3 = 0;
+            }
+        }
+        else if(evento == EV_PIEZA){
+            // La cuenta real está en piezasPendientes; PasoConteo() la toma.
+            // El evento solo indica que hubo actividad del sensor.
+        }
+#ifdef TRAZA_EVENTOS
+        else if(evento == (EV_LARGA | TECLA_LUZ)){
+            VuelcaTraza();
+        }
+        // LUZ sostenida 1 s: envía la traza por la EUSART.
+#endif
+        else if(evento < EV_SUELTA){
+            if(midiendoDespertar == 1){
+                msDespertarTeclado = LeeMilisegundos() - inicioDespertar;
+                midiendoDespertar  = 0;
+            }
+            // Primera tecla después de salir de ENERGIA_DORMIDO: latencia de despertar.
 
-                    LATE = 0b00000011;    
-                    // Pone el LED RGB en rojo (segn tu tabla de colores).
+            DespachaUI(evento);
+            // Las acciones se ejecutan al presionar. EV_SUELTA queda disponible
+            // para funciones que la necesiten.
+        }
+        else if((evento & 0xF0) == EV_LARGA){
+            DespachaUI(evento);
+            // Tecla sostenida 1 s (selección de receta).
+        }
+    }
 
-                    BorraLCD(); 
-                    OcultarCursor();
-                    MensajeLCD_Var("    PARADA DE");
-                    DireccionaLCD(0xC2);
-                    MensajeLCD_Var("EMERGENCIA");
+    if(recetaPedida != 0 && bytesEEPROMPendientes == 0){
+        DespachaUI(EV_RECETA_LISTA);
+        recetaPedida = 0;
+    }
+    // La receta se lee cuando la ISR terminó el registro que estaba guardando (usa
+    // EEADR), antes de que AtiendePersistencia() arranque otro. Si el estado cambió
+    // mientras tanto (parada de emergencia), no hay fila y la receta se descarta.
 
-                    while(1){}            
-                    // Bucle infinito ? el sistema queda "muerto" hasta reset.
-                }
+    AtiendePersistencia();
+    // Como el bucle principal pasa por aquí en cada vuelta, también se encarga de que los
+    // guardados pedidos lleguen a la EEPROM.
+}
 
-                // -------- FILA 3 (RB2 activa) --------
-                else{
-                    LATB = 0b11111011;    
-                    // Activa fila 3 (RB2 = 0).
-
-                    if(RB4 == 0){         
-                        // Tecla '7'
-                        teclaLeida = 7; 
-                        ConfigPregunta();
-                    }
-                    else if(RB5 == 0){    
-                        // Tecla '8'
-                        teclaLeida = 8; 
-                        ConfigPregunta();
-                    }
-                    else if(RB6 == 0){    
-                        // Tecla '9'
-                        teclaLeida = 9; 
-                        ConfigPregunta();
-                    } 
-                    else if(RB7 == 0){    
-                        // Tecla SUPR (borrar objetivo).
-                        Borrar();
-                        // Limpia lo que el usuario estaba escribiendo como objetivo.
-                    }
-
-                    // -------- FILA 4 (RB3 activa) --------
-                    else{
-                        LATB = 0b11110111; 
-                        // Activa fila 4 (RB3 = 0).
-
-                        if(RB4 == 0){      
-                            // Tecla de REINICIO de conteo.
-                            unidades7Seg          = 0;
-                            piezasTotalesContadas = 0;
-                            decenasRGB            = 0;
-
-                            LATE = 0b00000001; 
-                            // LED RGB vuelve a Magenta.
-
-                            if(flagConteoActivo == 1){
-                                // Si estamos en modo conteo, actualizamos tambin el LCD y el 7 segmentos.
-
-                                DireccionaLCD(0x8B);
-                                // Nos paramos donde se muestran los faltantes.
-
-                                EscribeLCD_n8(piezasObjetivo - piezasTotalesContadas, 2);
-                                // Muestra de nuevo los faltantes (que ahora es el objetivo completo).
-
-                                LATD = unidades7Seg;
-                                // Siete segmentos vuelve a 0.
-                            }
-                        }
-                        else if(RB5 == 0){ 
-                            // Tecla '0'
-                            teclaLeida = 0; 
-                            ConfigPregunta();
-                        }
-                        else if(RB6 == 0){ 
-                            // Tecla FIN: fuerza que la cuenta se considere como cumplida
-                            // sin tener que contar fsicamente todas las piezas.
-
-                            Borrar();
-                            piezasTotalesContadas = piezasObjetivo;
-                            // Se iguala el conteo total al objetivo.
-
-                            decenasRGB = piezasObjetivo / 10;
-                            // Se calculan las decenas del objetivo para el RGB.
-
-                            unidades7Seg = piezasObjetivo - decenasRGB * 10;
-                            // Se calculan las unidades para el 7 segmentos.
-
-                            // Actualizar color RGB segn decenas
-                            if(decenasRGB == 0){
-                                LATE = 0b00000001; // Magenta
-                            }else if(decenasRGB == 1){
-                                LATE = 0b00000101; // Azul
-                            }else if(decenasRGB == 2){
-                                LATE = 0b00000100; // Cyan
-                            }else if(decenasRGB == 3){
-                                LATE = 0b00000110; // Verde
-                            }else if(decenasRGB == 4){
-                                LATE = 0b00000010; // Amarillo
-                            }else if(decenasRGB == 5){
-                                LATE = 0b00000000; // Blanco
-                            }
-
-                            LATD = unidades7Seg; 
-                            // Muestra en el 7 segmentos las unidades calculadas del objetivo.
-                        }
-                        else if(RB7 == 0){ 
-                            // Tecla LUZ: control manual del backlight o luz asociada a RA3.
-                            LATA3 = LATA3 ^ 1;  
-                            // Conmuta RA3 (enciende/apaga la luz).
-
-                            TMR0ON = 1;         
-                            // Asegura que Timer0 siga encendido despus de esta accin.
-                        }
-                    } 
-                }
+// ======================== FUNCIONES: MÁQUINA DE ESTADOS DE LA INTERFAZ ========================
+
+void DespachaUI(unsigned char evento){
+    // Recorre transicionesUI[] y ejecuta la primera fila que coincide con el estado
+    // actual y el evento. Se llama desde main(): teclas (AtiendeEventos()), EV_TIEMPO
+    // y EV_META. Ninguna acción espera: a lo sumo arma un temporizador.
+    const TransicionUI *t;
+    unsigned char siguiente;
+
+    if(evento < EV_SEGUNDO){
+        teclaLeida = evento & 0x0F;
+    }
+    // La tecla queda disponible para la acción (ConfigPregunta() usa el dígito,
+    // TeclaReceta() el número de receta).
+
+    for(unsigned char i = 0; i < sizeof(transicionesUI) / sizeof(transicionesUI[0]); i++){
+        t = &transicionesUI[i];
+        // El largo sale del tamaño de la tabla: no hay una fila de cierre que pueda
+        // confundirse con {EST_OBJETIVO, 0, ...} (estado 0, tecla 0).
+        if((t->estado == estadoUI || t->estado == EST_CUALQUIERA) &&
+           (t->evento == evento || t->evento == EV_CUALQUIERA ||
+            (t->evento == EV_DIGITO && evento <= 9) ||
+            (t->evento == EV_RECETA && evento >= (EV_LARGA | 1) && evento <= (EV_LARGA | 9)))){
+            siguiente = t->accion();
+            if(siguiente != estadoUI){
+                CambiaEstadoUI(siguiente);
             }
+            return;
+        }
+    }
+    // Un evento sin fila para el estado actual se ignora.
+}
 
-            LATB = 0b11110000;          
-            // Restablece las filas: RB0?RB3 = 1, se ?desactiva? el teclado
-            // hasta la prxima interrupcin.
+void CambiaEstadoUI(unsigned char estado){
+    estadoUI               = estado;
+    duracionTemporizadorUI = 0;
+    // El temporizador pertenece al estado que se deja.
 
+    estadosUI[estado].alEntrar();
+}
+
+void ArmaTemporizadorUI(unsigned int ms){
+    inicioTemporizadorUI   = LeeMilisegundos();
+    duracionTemporizadorUI = ms;
+}
+
+// --- Acciones de entrada ---
+
+void EntraBienvenida(void){
+    // Mensaje con estrellas. Nada espera aquí: el temporizador del estado marca
+    // cuándo empieza la animación y cada uno de sus pasos (PasoBienvenida()).
+    CrearCaracter(Estrella, GLIFO_ESTRELLA);
+    // Envía el arreglo Estrella a la CGRAM del LCD en la posición 0 (si no estaba ya).
+
+    DibujaPantalla(pantallaBienvenida);
+    // Dos estrellas, "Bienvenido" y otras dos estrellas en la primera línea;
+    // "Operario" en la segunda, también rodeado de estrellas.
+
+    pasosBienvenida = 0;
+    ArmaTemporizadorUI(BIENVENIDA_MS);
+    // ~3.2 segundos para que el operador pueda leer el mensaje.
+}
+
+void EntraObjetivo(void){
+    // Pantalla "Piezas a contar:" con un marco por cifra y el cursor en la primera.
+    CrearCaracter(Marco, GLIFO_MARCO);
+    // Crea el carácter especial Marco en la posición 1 de CGRAM.
+    // Es un cuadro para marcar la posición de ingreso. Solo se envía en el primer
+    // lote: la librería recuerda que la posición 1 ya lo tiene.
+
+    piezasObjetivo       = 0;
+    indiceDigitoObjetivo = 0;
+    // Arrancamos escribiendo la primera cifra.
+
+    DibujaPantalla(pantallaObjetivo);
+    // "Piezas a contar:" en la primera línea y un 'Marco' por cifra en la segunda,
+    // donde irán las cifras del objetivo.
+
+    FijaCursorFB(CELDA_OBJETIVO);
+    MostrarCursor();
+    // El cursor parpadea al inicio de la primera cifra.
+
+    modoEdicionObjetivo = 1;
+    // Activa el modo de edición. Esto hace que ConfigPregunta() sea efectiva.
+}
+
+void EntraError(void){
+    // Objetivo fuera de rango (0 o más de OBJETIVO_MAX).
+    modoEdicionObjetivo = 0;
+    piezasObjetivo      = 0;
+
+    DibujaPantalla(pantallaError);
+    FijaCursorFB(SIN_CURSOR_FB);
+    OcultarCursor();
+
+    ArmaTemporizadorUI(1000);
+    // A 1 s pasa a EST_LIMITES. Mientras tanto las teclas se ignoran.
+}
+
+void EntraLimites(void){
+    DibujaPantalla(pantallaLimites);
+    ArmaTemporizadorUI(2000);
+    // A 2 s vuelve a pedir "Piezas a contar:".
+}
+
+void EntraConteo(void){
+    // Empieza (o retoma) un lote con el objetivo ya aceptado.
+    OcultarCursor();
+    // Después de aceptar el objetivo, ya no queremos el cursor parpadeando en esa zona.
+
+    faltantesBCD = BinarioABCD16(piezasObjetivo - piezasTotalesContadas);
+    // Cuántas piezas faltan para llegar al objetivo (5 dígitos).
+    // Al inicio, piezasTotalesContadas = 0 (salvo en un lote recuperado), así que
+    // muestra el objetivo completo.
+    // Es la única conversión binario -> BCD del lote; luego solo se decrementa.
+
+    DibujaConteo();
+    // Pantalla del conteo en la vista que esté elegida, ya con los faltantes.
+
+    ReiniciaRitmo();
+    MuestraRitmo();
+    // Las cifras del ritmo van en CELDA_RITMO y las actualiza MuestraRitmo()
+    // cada segundo.
+
+    if(loteRecuperado == 0){
+        CCP2IE           = 0;
+        piezasExcedentes += piezasPendientes;
+        piezasPendientes = 0;
+        CCP2IE           = 1;
+    }else{
+        msArranqueConteo = LeeMilisegundos();
+    }
+    // Descarta los flancos que llegaron mientras se pedía el objetivo: solo se
+    // cuentan las piezas que pasen a partir de este momento. En un lote recuperado
+    // no hubo pregunta: las piezas capturadas durante el arranque son del lote.
+
+    FijaPerfilReloj(PERFIL_RAPIDO);
+    // Durante el lote la CPU corre a 8 MHz: la ISR y el bucle principal tardan 8
+    // veces menos en tiempo real (los mismos ciclos).
+
+    flagConteoActivo = 1;
+    // Marca que hay un lote en conteo (se guarda en la EEPROM).
+
+    SolicitaGuardado();
+    // Guarda el objetivo del lote nuevo (y el conteo, si es un lote recuperado).
+
+    EnviaTrama(TRAMA_INICIO_LOTE, piezasObjetivo, piezasTotalesContadas);
+}
+
+void MuestraLote(void){
+    if(vistaConteo != VISTA_NORMAL){
+        return;
+    }
+    // Las otras vistas no tienen lugar para el lote.
+    EscribeFB_n8(CELDA_LOTE + 1, loteActual, 2);
+    EscribeFB_n8(CELDA_LOTE + 4, lotesReceta, 2);
+    // "L" + lote actual + "/" + total de lotes de la receta.
+}
+
+void DibujaConteo(void){
+    // Pantalla completa del conteo en la vista elegida (normal o cifras grandes).
+    if(vistaConteo == VISTA_GRANDE){
+        CrearCaracter(BarraSuperior, GLIFO_BARRA_SUP);
+        CrearCaracter(BarraInferior, GLIFO_BARRA_INF);
+        CrearCaracter(BarrasDobles,  GLIFO_BARRAS);
+        CrearCaracter(LadoIzquierdo, GLIFO_LADO_IZQ);
+        CrearCaracter(LadoDerecho,   GLIFO_LADO_DER);
+        // Los 5 segmentos solo viajan al LCD la primera vez (50 bytes): después la
+        // librería ve que ya están en CGRAM y no envía nada.
+
+        BorraFB();
+        for(unsigned char i = 0; i < DIGITOS_OBJETIVO; i++){
+            cifraGrandeMostrada[i] = SIN_CIFRA;
         }
+        // Pantalla en blanco: MuestraFaltantes() dibuja todas las cifras.
+    }
+    else if(recetaActiva == 0){
+        DibujaPantalla(pantallaConteo);
+    }else{
+        DibujaPantalla(pantallaConteoReceta);
+        MuestraLote();
+    }
+    // "Faltantes:" en la primera línea y "Ritmo:      p/m" (o "Lkk/nn      p/m"
+    // con receta) en la segunda.
 
-        __delay_ms(300);                
-        // Retardo para antirrebote general del teclado. Evita que una misma pulsacin
-        // genere mltiples interrupciones demasiado seguidas.
+    MuestraFaltantes();
+}
 
-        RBIF = 0;                       
-        // Limpia la bandera de interrupcin de PORTB para poder detectar nuevos cambios.
+void MuestraFaltantes(void){
+    // Escribe faltantesBCD en la pantalla virtual. En la vista grande cada cifra
+    // ocupa 3 columnas de las dos filas, sin ceros a la izquierda, y solo se
+    // reescriben las columnas de las cifras que cambiaron.
+    unsigned long bcd = faltantesBCD;
+    unsigned char cifra;
+    unsigned char celda = 0;
+    unsigned char ceros = 1;
+
+    if(vistaConteo == VISTA_NORMAL){
+        EscribeFB_bcd(CELDA_FALTANTES, faltantesBCD, DIGITOS_OBJETIVO);
+        return;
     }
+
+    for(unsigned char i = 0; i < DIGITOS_OBJETIVO; i++){
+        cifra = (bcd >> (4 * (DIGITOS_OBJETIVO - 1))) & 0x0F;
+        bcd <<= 4;
+        // Cifra más significativa primero (siempre el mismo desplazamiento).
+
+        if(cifra != 0 || i == DIGITOS_OBJETIVO - 1){
+            ceros = 0;
+        }
+        if(ceros == 1){
+            cifra = CIFRA_EN_BLANCO;
+        }
+        // Los ceros a la izquierda quedan en blanco; las unidades siempre se ven.
+
+        if(cifra != cifraGrandeMostrada[i]){
+            cifraGrandeMostrada[i] = cifra;
+            for(unsigned char j = 0; j < COLUMNAS_CIFRA; j++){
+                EscribeFB_c(celda + j,      cifraGrande[cifra][j]);
+                EscribeFB_c(celda + 16 + j, cifraGrande[cifra][COLUMNAS_CIFRA + j]);
+            }
+        }
+        // Una pieza normalmente cambia solo las unidades: 6 celdas, y de ellas
+        // RefrescaLCD() manda solo las que tienen otro segmento.
+        celda += COLUMNAS_CIFRA;
+    }
+}
+
+void EntraCumplida(void){
+    // Lote terminado: aviso de 1 s con RA2 y mensaje hasta que se pulse OK.
+    FijaPerfilReloj(PERFIL_LENTO);
+    // Se vuelve a 1 MHz para el aviso y la espera de OK.
+
+    LATA2      = 1;
+    beepActivo = 0;
+    ArmaTemporizadorUI(1000);
+    // Aviso con RA2 (buzzer o LED) - señal de objetivo cumplido. Lo apaga
+    // FinAvisoCumplido() sin detener el resto del programa.
+
+    DibujaPantalla(pantallaCumplida);
+
+    flagConteoActivo = 0;
+
+    SolicitaGuardado();
+    // El lote queda guardado como terminado: al reiniciar no se retoma.
+
+    EnviaTrama(TRAMA_LOTE_CUMPLIDO, piezasObjetivo, piezasExcedentes);
+}
+
+void EntraEmergencia(void){
+    // La ISR ya dejó el RGB en rojo y detuvo la captura; aquí se muestra el aviso.
+    unsigned int inicio;
+    // Milisegundos al pedir el guardado.
+
+    DibujaPantalla(pantallaEmergencia);
+    FijaCursorFB(SIN_CURSOR_FB);
+    OcultarCursor();
+    RefrescaLCD();
+    VaciaColaLCD();
+
+    EnviaTrama(TRAMA_EMERGENCIA, LeeMilisegundos(), piezasTotalesContadas);
+    VaciaColaTX();
+
+    inicio = LeeMilisegundos();
+    SolicitaGuardado();
+    while(guardadoPendiente == 1 || bytesEEPROMPendientes != 0){
+        AtiendePersistencia();
+    }
+    msEsperaEmergencia = LeeMilisegundos() - inicio;
+    // Acotado por msEsperaEmergencia (ver su declaración); lo mide estres_parada.
+    // Se guarda el lote tal como quedó: después del reset se retoma desde ahí.
+    // EST_EMERGENCIA no tiene salida: el sistema queda detenido hasta el reset,
+    // pero main() sigue durmiendo entre interrupciones en vez de girar en un while(1).
 }
 
-// ======================== FUNCIN: CONFIGURAR VARIABLES ========================
+void PasoConteo(void){
+    // Se ejecuta en cada vuelta del bucle principal mientras el estado es EST_CONTEO.
+    unsigned int nuevasPiezas;
+    // Piezas tomadas de piezasPendientes en esta vuelta.
+
+    if(piezasTotalesContadas == piezasObjetivo){
+        DespachaUI(EV_META);
+        return;
+    }
+    // Se llegó al objetivo (contando o con la tecla FIN).
+
+    // Apagar el beep de decena cuando ya pasó su duración (sin bloquear el conteo)
+    if(beepActivo == 1 && (unsigned int)(LeeMilisegundos() - inicioBeep) >= BEEP_DECENA_MS){
+        LATA2      = 0;
+        beepActivo = 0;
+    }
+
+    // Tomar de forma atómica las piezas que capturó la ISR (CCP2 en RC1)
+    CCP2IE           = 0;
+    nuevasPiezas     = piezasPendientes;
+    piezasPendientes = 0;
+    CCP2IE           = 1;
+    // Con CCP2IE en 0 la ISR no puede modificar piezasPendientes a mitad de la lectura.
+    // Si llega un flanco en ese instante, CCP2IF queda pendiente y se atiende al reactivar.
+
+    if(nuevasPiezas == 0){
+        return;
+    }
+    // Sin piezas nuevas no hay nada más que hacer en esta vuelta.
+
+    segundosSinActividad = 0;
+    // Se reinicia el contador de inactividad para que no entre en Sleep.
+
+    if(nuevasPiezas > piezasObjetivo - piezasTotalesContadas){
+        if(loteActual < lotesReceta){
+            CCP2IE            = 0;
+            piezasPendientes += nuevasPiezas - (piezasObjetivo - piezasTotalesContadas);
+            CCP2IE            = 1;
+        }else{
+            piezasExcedentes += nuevasPiezas - (piezasObjetivo - piezasTotalesContadas);
+        }
+        nuevasPiezas = piezasObjetivo - piezasTotalesContadas;
+    }
+    // Las piezas que pasen de la meta no se cuentan en este lote: si la receta
+    // tiene otro lote se devuelven a piezasPendientes y abren el siguiente; si no,
+    // quedan como excedentes (igual que antes).
+
+    INICIO_CICLOS(MED_SUMA_PIEZAS);
+
+    // Actualizar contadores: una vuelta por pieza, sin esperas
+    while(nuevasPiezas != 0){
+        nuevasPiezas--;
+
+        unidades7Seg++;
+        // Aumenta las unidades (para el display de 7 segmentos).
+
+        piezasTotalesContadas++;
+        piezasContadasTotal++;
+        // Aumenta el total de piezas (del lote y desde el arranque).
+
+        faltantesBCD = DecrementaBCD(faltantesBCD);
+        // Una pieza menos por contar, directamente en BCD.
+
+        piezasSinGuardar++;
+
+        // Cuando se llega a 10 unidades, se suma una decena
+        if (unidades7Seg == 10){
+
+            // Aviso corto con RA2: beep para indicar que se completó una decena.
+            // Se apaga arriba, al cumplirse BEEP_DECENA_MS, sin detener el conteo.
+            LATA2      = 1;
+            beepActivo = 1;
+            inicioBeep = LeeMilisegundos();
+
+            unidades7Seg = 0;
+            // Reinicia unidades de 0 a 9
+
+            decenasRGB++;
+            // Incrementa el contador de decenas, que luego se refleja en el color del RGB.
+
+            if (decenasRGB == 6){
+                // Si llega a 6 decenas (60 piezas), se reinicia a 0.
+                // Solo hay 6 colores: el RGB repite la secuencia cada 60 piezas.
+                decenasRGB = 0;
+            }
+        }
+    }
+
+    FIN_CICLOS(MED_SUMA_PIEZAS);
+
+    EnviaTrama(TRAMA_PIEZA, LeeMilisegundos(), piezasTotalesContadas);
+    // Una trama por tanda de piezas nuevas (normalmente una sola pieza).
+
+    // El conteo no se guarda aquí: AtiendeEventos() lo guarda cada
+    // SEGUNDOS_ENTRE_GUARDADOS si hay piezas sin guardar (ver la vida de la EEPROM).
+
+    // Actualizar color del RGB (decenas) y siete segmentos (unidades)
+    ActualizaSalidas();
+    // Una sola escritura de cada puerto, con el color tomado de coloresDecena[].
+
+    // Actualizar faltantes en la pantalla virtual
+    MuestraFaltantes();
+    midiendoBytesFaltantes = 1;
+    // Escribe de nuevo cuántas piezas faltan (5 dígitos), en la vista normal o en
+    // cifras grandes. main() mide cuántos bytes manda RefrescaLCD() por este cambio.
+}
+
+// --- Acciones de las transiciones ---
+
+unsigned char PasoBienvenida(void){
+    // Desplaza el texto hacia la derecha (pequeña animación), un carácter por paso.
+    if(pasosBienvenida < PASOS_BIENVENIDA){
+        DesplazaPantallaD();
+        pasosBienvenida++;
+        ArmaTemporizadorUI(PASO_BIENVENIDA_MS);
+        return EST_BIENVENIDA;
+    }
+    return SaltaBienvenida();
+}
+
+unsigned char SaltaBienvenida(void){
+    CursorAInicio();
+    // Deshace el desplazamiento de la pantalla. Las siguientes pantallas se dibujan
+    // sobre la virtual, así que no hace falta borrar el LCD.
+    return EST_OBJETIVO;
+}
+
+unsigned char TeclaDigito(void){
+    ConfigPregunta();
+    // Escribe la cifra sobre su marco y la agrega a piezasObjetivo.
+    return EST_OBJETIVO;
+}
+
+unsigned char TeclaReceta(void){
+    // Tecla 1-9 sostenida en "Piezas a contar:": pide la receta de esa tecla.
+    // No espera a la EEPROM: AtiendeEventos() genera EV_RECETA_LISTA cuando la ISR
+    // termina el registro que esté guardando (como mucho ~32 ms).
+    recetaPedida = teclaLeida;
+    return EST_OBJETIVO;
+}
+
+unsigned char CargaReceta(void){
+    // EEPROM libre: lee la receta pedida y, si tiene lotes, arranca el conteo.
+    // Al presionar la tecla ya se escribió la cifra; si la receta está vacía solo se
+    // quita esa cifra y queda lo que el operador había digitado antes.
+    unsigned int objetivo;
+    unsigned char lotes;
+
+    lotes = LeeReceta(recetaPedida, &objetivo);
+
+    if(lotes == 0){
+        BorraUltimaCifra();
+        return EST_OBJETIVO;
+    }
+
+    piezasObjetivo       = objetivo;
+    recetaActiva         = recetaPedida;
+    lotesReceta          = lotes;
+    loteActual           = 1;
+    modoEdicionObjetivo  = 0;
+    indiceDigitoObjetivo = 0;
+    FijaCursorFB(SIN_CURSOR_FB);
+    return EST_CONTEO;
+}
+
+unsigned char TeclaBorrar(void){
+    Borrar();
+    // Limpia lo que el usuario estaba escribiendo como objetivo.
+    return EST_OBJETIVO;
+}
+
+unsigned char TeclaAceptar(void){
+    // OK: valida el rango del objetivo, 1 a OBJETIVO_MAX
+    // (ConfigPregunta() deja piezasObjetivo en 0 si el número no cabe en 16 bits).
+    modoEdicionObjetivo  = 0;
+    indiceDigitoObjetivo = 0;
+    FijaCursorFB(SIN_CURSOR_FB);
+
+    if(piezasObjetivo == 0){
+        return EST_ERROR;
+    }
+    return EST_CONTEO;
+}
+
+unsigned char TeclaReinicio(void){
+    // REINICIO de conteo.
+    unidades7Seg          = 0;
+    piezasTotalesContadas = 0;
+    decenasRGB            = 0;
+    CCP2IE                = 0;
+    piezasPendientes      = 0;
+    CCP2IE                = 1;
+    // También se descartan las capturas que aún no se habían procesado.
+
+    ActualizaSalidas();
+    // LED RGB vuelve a Magenta y el siete segmentos a 0.
+
+    SolicitaGuardado();
+
+    faltantesBCD = BinarioABCD16(piezasObjetivo);
+    MuestraFaltantes();
+    // Muestra de nuevo los faltantes (que ahora es el objetivo completo).
+    return EST_CONTEO;
+}
+
+unsigned char TeclaFin(void){
+    // FIN: fuerza que la cuenta se considere como cumplida
+    // sin tener que contar físicamente todas las piezas.
+    piezasTotalesContadas = piezasObjetivo;
+    CCP2IE                = 0;
+    piezasPendientes      = 0;
+    CCP2IE                = 1;
+    // Se iguala el conteo total al objetivo.
+
+    CalculaSalidas(piezasObjetivo);
+    // Unidades y decenas del objetivo para el 7 segmentos y el RGB.
+
+    faltantesBCD = 0;
+    // Ya no falta ninguna pieza.
+
+    ActualizaSalidas();
+    // Color de las decenas y unidades calculadas del objetivo en el 7 segmentos.
+
+    return EST_CONTEO;
+    // En la próxima vuelta PasoConteo() ve la meta cumplida y genera EV_META.
+}
+
+#ifdef MULTICARRIL
+void EntraCarriles(void){
+    // Conteo de cada carril. Los carriles cuentan en la ISR en cualquier estado;
+    // aquí solo se muestran.
+    modoEdicionObjetivo = 0;
+
+    DibujaPantalla(pantallaCarriles);
+    FijaCursorFB(SIN_CURSOR_FB);
+    OcultarCursor();
+
+    segundosCarril = 0;
+    MuestraCarril();
+    // Empieza por el carril que se mostraba la última vez.
+}
+
+unsigned char TeclaCarriles(void){
+    // FIN en "Piezas a contar:": pasa a la pantalla de los carriles.
+    return EST_CARRILES;
+}
+
+unsigned char SalCarriles(void){
+    // OK o FIN en los carriles: vuelve a pedir el objetivo (desde la primera cifra).
+    return EST_OBJETIVO;
+}
+
+void MuestraCarril(void){
+    unsigned int piezas;
+
+    GIEL  = 0;
+    piezas = conteoCarril[carrilMostrado];
+    GIEL  = 1;
+    // Copia atómica: la ISR lo modifica cada milisegundo.
+
+    EscribeFB_n8(CELDA_CARRIL, carrilMostrado + 1, 1);
+    EscribeFB_n16(CELDA_CONTEO_CARRIL, piezas, 5);
+    EscribeFB_n16(CELDA_META_CARRIL, metaCarril[carrilMostrado], 5);
+    EscribeFB_n8(CELDA_LOTES_CARRIL, lotesCarril[carrilMostrado], 3);
+}
+
+void RotaCarril(void){
+    segundosCarril++;
+    if(segundosCarril >= SEGUNDOS_POR_CARRIL){
+        segundosCarril = 0;
+        do{
+            carrilMostrado = (carrilMostrado + 1) & (TOTAL_CARRILES - 1);
+        }while((CARRILES_ACTIVOS & (1u << carrilMostrado)) == 0);
+        // Salta los bits de PORTC que no tienen sensor.
+    }
+    MuestraCarril();
+    // El carril que queda en pantalla se actualiza cada segundo.
+}
+#endif
+
+unsigned char TeclaVista(void){
+    // OK durante el conteo: pasa a la vista siguiente (normal o faltantes en cifras
+    // grandes legibles desde lejos).
+    vistaConteo++;
+    if(vistaConteo == TOTAL_VISTAS){
+        vistaConteo = VISTA_NORMAL;
+    }
+
+    DibujaConteo();
+    MuestraRitmo();
+    // Redibuja la pantalla del conteo; el ritmo solo aparece en la vista normal.
+
+    bytesMaxFaltantes = 0;
+    // La medición de bytes vuelve a empezar para la vista nueva.
+    return EST_CONTEO;
+}
+
+unsigned char TeclaLuz(void){
+    // LUZ: control manual del backlight o luz asociada a RA3 (en cualquier estado).
+    LATA3 = LATA3 ^ 1;  
+    // Conmuta RA3 (enciende/apaga la luz).
+
+    return estadoUI;
+}
+
+unsigned char TeclaEmergencia(void){
+    return EST_EMERGENCIA;
+    // EntraEmergencia() muestra el aviso y guarda el lote.
+}
+
+unsigned char TeclaNuevoLote(void){
+    // OK después de "Cuenta Cumplida": todo vuelve a los valores iniciales.
+    LATA2 = 0;
+    // Por si se pulsa OK antes de que termine el aviso.
+
+    ConfigVariables();
+    // Resetea todos los contadores, banderas y estado interno para iniciar de nuevo.
+
+    ActualizaSalidas();
+    // ConfigVariables() ya dejó decenas y unidades en 0: RGB en Magenta como estado
+    // de "reposo" y 0 en el 7 segmentos.
+    return EST_OBJETIVO;
+}
+
+unsigned char FinError(void){
+    return EST_LIMITES;
+}
+
+unsigned char FinLimites(void){
+    return EST_OBJETIVO;
+}
+
+unsigned char FinAvisoCumplido(void){
+    LATA2 = 0;
+    return EST_CUMPLIDA;
+    // Se sigue esperando OK.
+}
+
+unsigned char MetaAlcanzada(void){
+    if(loteActual >= lotesReceta){
+        return EST_CUMPLIDA;
+    }
+    // Último lote (o lote digitado a mano): "Cuenta Cumplida" y espera OK.
+
+    EnviaTrama(TRAMA_LOTE_CUMPLIDO, piezasObjetivo, piezasExcedentes);
+
+    loteActual++;
+    unidades7Seg          = 0;
+    decenasRGB            = 0;
+    piezasTotalesContadas = 0;
+    // El siguiente lote de la receta arranca ya, sin pasar por "Cuenta Cumplida".
+
+    LATA2      = 1;
+    beepActivo = 1;
+    inicioBeep = LeeMilisegundos();
+    // Beep corto (como el de decena) para avisar el cambio de lote.
+
+    faltantesBCD = BinarioABCD16(piezasObjetivo);
+    MuestraFaltantes();
+    MuestraLote();
+    ActualizaSalidas();
+
+    SolicitaGuardado();
+    EnviaTrama(TRAMA_INICIO_LOTE, piezasObjetivo, piezasTotalesContadas);
+    return EST_CONTEO;
+}
+
+unsigned char IgnoraEvento(void){
+    return estadoUI;
+}
+
+// ======================== FUNCIÓN: CONFIGURAR VARIABLES ========================
 
 void ConfigVariables(void){ 
-    // Esta funcin deja todas las variables globales en estado inicial.
+    // Esta función deja todas las variables globales en estado inicial.
     // Se llama:
     //  - al comienzo del main,
-    //  - despus de cumplir la cuenta y pulsar OK.
+    //  - después de cumplir la cuenta y pulsar OK.
 
-    pulsadorListo         = 1;   
-    // Indica que el pulsador RC1 est listo para detectar una nueva pulsacin.
-    // Con esto evitamos contar hasta que veamos primero una bajada a 0.
+    CCP2IE                = 0;
+    piezasExcedentes     += piezasPendientes;
+    piezasPendientes      = 0;
+    CCP2IE                = 1;
+    // Descarta capturas de RC1 aún no procesadas (se deshabilita CCP2IE mientras
+    // se escribe porque la variable es de 16 bits y también la modifica la ISR).
+
+    beepActivo            = 0;
+    // Ningún beep de decena en curso.
+
+    desbordesTimer3       = 2;
+    // Aún no hay pieza previa: la primera captura se acepta sin filtro de rebote.
 
     unidades7Seg          = 0;   
     // El display de 7 segmentos arranca mostrando 0.
@@ -723,217 +2568,650 @@ void ConfigVariables(void){
     // Al inicio no estamos dentro del ciclo de conteo.
 
     piezasTotalesContadas = 0;  
-    // Ninguna pieza ha sido contada todava.
+    // Ninguna pieza ha sido contada todavía.
 
     decenasRGB            = 0;   
-    // Las decenas de RGB arrancan en 0 ? el color inicial se pondr como magenta
+    // Las decenas de RGB arrancan en 0 ? el color inicial se pondrá como magenta
     // cuando se actualice.
 
     indiceDigitoObjetivo  = 0;   
-    // Inicialmente se est en el primer dgito del objetivo.
+    // Inicialmente se está en el primer dígito del objetivo.
 
     piezasObjetivo        = 0;   
-    // Objetivo inicial invlido (0). Se cambia cuando el usuario ingresa un valor.
+    // Objetivo inicial inválido (0). Se cambia cuando el usuario ingresa un valor.
+
+    recetaActiva          = 0;
+    recetaPedida          = 0;
+    loteActual            = 1;
+    lotesReceta           = 1;
+    // Sin receta: un solo lote con el objetivo que se digite.
 
     teclaLeida            = '\0';
-    // Sin tecla vlida leda todava.
+    // Sin tecla válida leída todavía.
 
     segundosSinActividad  = 0;   
-    // Contador de inactividad en 0. Empezar a contar a partir del Timer0.
+    // Contador de inactividad en 0. Lo incrementa la ISR cada segundo.
 }
 
-// ======================== FUNCIN: MENSAJE DE BIENVENIDA ========================
+// ======================== FUNCIÓN: CONFIGURAR ENTRADA DE OBJETIVO ========================
 
-void Bienvenida(void){
-    // CONFIGURACIN DEL LCD
-
-    ConfiguraLCD(4);          
-    // Indica a la librera que se trabajar en modo de interfaz de 4 bits.
+void ConfigPregunta(void){ 
+    // Función que se llama desde TeclaDigito() cada vez que se pulsa una tecla numérica.
+    // Construye el valor de piezasObjetivo cifra por cifra, de izquierda a derecha
+    // (hasta DIGITOS_OBJETIVO cifras), siempre que modoEdicionObjetivo = 1.
+    unsigned long valor;
+
+    INICIO_CICLOS(MED_CONFIG_PREGUNTA);
+
+    if(indiceDigitoObjetivo < DIGITOS_OBJETIVO && modoEdicionObjetivo == 1){
+        EscribeFB_n8(CELDA_OBJETIVO + indiceDigitoObjetivo, teclaLeida, 1);
+        // Escribe la cifra (0?9) sobre su Marco.
+
+        valor = (unsigned long)piezasObjetivo * 10 + teclaLeida;
+        // Agrega la cifra a la derecha del número.
+        // Ejemplo: si ya se digitó 12 y ahora llega 5: 12 * 10 + 5 = 125.
+        if(valor > OBJETIVO_MAX){
+            valor = 0;
+        }
+        piezasObjetivo = (unsigned int)valor;
+        // Un número que no cabe en 16 bits queda en 0 y TeclaAceptar() lo rechaza.
 
-    InicializaLCD();          
-    // Ejecuta la secuencia de inicializacin del LCD (comandos especiales),
-    // borra la pantalla y enciende el display.
+        indiceDigitoObjetivo++;
+        // Avanza a la siguiente cifra.
 
-    OcultarCursor();
-    // Oculta el cursor para que no se vea el parpadeo durante la bienvenida.
-
-    // Crear carcter especial Estrella en la posicin 0 de CGRAM
-    CrearCaracter(Estrella, 0);
-    // Enva el arreglo Estrella a la CGRAM del LCD en la posicin 0.
-    // A partir de aqu, EscribeLCD_c(0) dibuja la estrella.
-
-    // Mensaje en pantalla con estrellas decorativas
-    EscribeLCD_c(0); 
-    EscribeLCD_c(0);
-    MensajeLCD_Var(" Bienvenido ");
-    EscribeLCD_c(0);
-    EscribeLCD_c(0);
-    // Imprime dos estrellas, la palabra " Bienvenido " y otras dos estrellas en la primera lnea.
-
-    DireccionaLCD(0xC0);
-    // Mueve el cursor al inicio de la segunda lnea.
-
-    EscribeLCD_c(0);
-    EscribeLCD_c(0);
-    MensajeLCD_Var("  Operario ");
-    EscribeLCD_c(0);
-    EscribeLCD_c(0);
-    // Escribe "  Operario " en la segunda lnea, tambin rodeado de estrellas.
-
-    __delay_ms(3200);
-    // Pausa ~3.2 segundos para que el operador pueda leer el mensaje.
-
-    // Desplazar el texto hacia la derecha (pequea animacin)
-    for(int i = 0; i < 18; i++){
-        DesplazaPantallaD();
-        // Cada llamada manda el comando de desplazar la pantalla un carcter a la derecha.
-        __delay_ms(100);
-        // Pequeo retardo para ver la animacin suavemente.
+        if(indiceDigitoObjetivo < DIGITOS_OBJETIVO){
+            FijaCursorFB(CELDA_OBJETIVO + indiceDigitoObjetivo);
+            // El cursor pasa al siguiente Marco.
+        }else{
+            FijaCursorFB(SIN_CURSOR_FB);
+            OcultarCursor();
+            // Se completaron las cinco cifras: se oculta el cursor y solo queda
+            // esperar a que el usuario pulse '*'.
+        }
     }
+
+    FIN_CICLOS(MED_CONFIG_PREGUNTA);
 }
 
-// ======================== FUNCIN: PREGUNTAR AL USUARIO ========================
+// ======================== FUNCIÓN: BORRAR OBJETIVO DEL USUARIO ========================
 
-void PreguntaAlUsuario(void){ 
-    // Se encarga de todo el flujo de preguntar ?Piezas a contar?.
-    // No sale de esta funcin hasta que el usuario ingrese un objetivo vlido
-    // (entre 01 y 59) y pulse la tecla OK ('*').
+void Borrar(void){ 
+    // Borra el valor escrito por el usuario en el LCD y reinicia la entrada del objetivo.
+    // Se llama desde TeclaBorrar() cuando se presiona la tecla SUPR.
 
-    while(1){
-        CrearCaracter(Marco, 1);       
-        // Crea el carcter especial Marco en la posicin 1 de CGRAM.
-        // Es un cuadro para marcar la posicin de ingreso.
+    if(modoEdicionObjetivo == 1){
+        // Solo tiene sentido borrar si estamos en modo de edición.
 
-        indiceDigitoObjetivo = 0;           
-        // Arrancamos escribiendo el primer dgito (decenas).
+        MostrarCursor();
+        // Muestra el cursor para señalar que puede volver a escribir.
 
-        // Mensaje en pantalla para ingreso de objetivo
-        BorraLCD();
-        MensajeLCD_Var("Piezas a contar:");
-        // Escribe en la primera lnea el mensaje de solicitud.
+        piezasObjetivo          = 0;
+        indiceDigitoObjetivo = 0;
+        // Reinicia el objetivo y el índice de dígito.
 
-        DireccionaLCD(0xC7);               
-        // Posiciona el cursor en la segunda lnea, columna adecuada para los dos dgitos.
+        for(unsigned char i = 0; i < DIGITOS_OBJETIVO; i++){
+            EscribeFB_c(CELDA_OBJETIVO + i, GLIFO_MARCO);
+        }
+        // Vuelve a dibujar los caracteres Marco (posición 1 en CGRAM) donde estaban
+        // las cifras, indicando que el usuario puede volver a digitarlas.
 
-        EscribeLCD_c(1);
-        EscribeLCD_c(1);
-        // Escribe dos veces el carcter especial 'Marco' (posicin 1 en CGRAM),
-        // marcando visualmente donde irn los dos dgitos.
+        FijaCursorFB(CELDA_OBJETIVO);
+        // Vuelve a ubicar el cursor en la posición de la primera cifra.
+    }
+}
 
-        DireccionaLCD(0xC7);
-        // Vuelve a posicionar el cursor al inicio del primer dgito.
+void BorraUltimaCifra(void){
+    // Deshace el último ConfigPregunta(): la cifra vuelve a ser un Marco y el cursor
+    // vuelve a ella. Se llama desde CargaReceta() cuando la receta está vacía.
+    if(modoEdicionObjetivo == 1 && indiceDigitoObjetivo != 0){
+        indiceDigitoObjetivo--;
+        piezasObjetivo /= 10;
+        // Quita la cifra de la derecha (solo en esta tecla, fuera del conteo).
 
+        EscribeFB_c(CELDA_OBJETIVO + indiceDigitoObjetivo, GLIFO_MARCO);
+        FijaCursorFB(CELDA_OBJETIVO + indiceDigitoObjetivo);
         MostrarCursor();
-        // Muestra el cursor para indicar que el usuario puede escribir.
+        // Con las cinco cifras el cursor estaba oculto: vuelve a verse.
+    }
+}
 
-        modoEdicionObjetivo = 1;           
-        // Activa el modo de edicin. Esto hace que ConfigPregunta() sea efectiva.
+// ======================== FUNCIÓN: DECREMENTO EN BCD ========================
+
+unsigned long DecrementaBCD(unsigned long bcd){
+    // Resta 1 a un número BCD empaquetado (0x00001-0x99999) sin pasar por binario.
+    // Si la cifra de unidades no es 0 basta con restar 1; si es 0, la resta en
+    // binario deja un nibble F, que se corrige a 9 restando 6 en ese nibble
+    // (0x0010 - 1 = 0x000F, menos 6 = 0x0009). Lo mismo para las cifras siguientes.
+
+    if((bcd & 0x0000F) != 0)
+        return bcd - 0x00001;        // 0x00035 -> 0x00034
+    if((bcd & 0x000F0) != 0)
+        return bcd - 0x00007;        // 0x00350 -> 0x00349
+    if((bcd & 0x00F00) != 0)
+        return bcd - 0x00067;        // 0x03500 -> 0x03499
+    if((bcd & 0x0F000) != 0)
+        return bcd - 0x00667;        // 0x35000 -> 0x34999
+    return bcd - 0x06667;            // 0x50000 -> 0x49999
+}
+
+// ======================== FUNCIÓN: SALIDAS RGB Y 7 SEGMENTOS ========================
 
-        teclaLeida          = '\0';
-        // Limpia la tecla previa.
+void ActualizaSalidas(void){
+    // Refleja decenasRGB (color del LED RGB) y unidades7Seg (siete segmentos, RD0-RD3).
+    // Es el único lugar, fuera de la parada de emergencia, que escribe LATE.
+    unsigned char color  = coloresDecena[decenasRGB];
+    unsigned char digito = (unsigned char)unidades7Seg;
+    // Se leen antes para que la sección crítica sea solo de dos escrituras.
 
-        // Esperar a que se presione OK ('*')
-        while(teclaLeida != '*'){
-            // Este while queda ?esperando? a que la ISR de PORTB detecte una tecla
-            // y actualice teclaLeida. ConfigPregunta() se encarga de imprimir
-            // los dgitos y armar piezasObjetivo.
+    GIE = 0;
+    if(CCP2CON != 0){
+        LATE = color;
+    }
+    // Con CCP2CON en 0 la ISR ya atendió la PARADA DE EMERGENCIA: se deja el rojo.
+    EscribeLATD_Bajo(digito);
+    GIE = 1;
+    // Con interrupciones deshabilitadas no queda un color nuevo con un dígito viejo
+    // (ni al revés) si la ISR entra entre las dos escrituras.
+}
+
+// ======================== FUNCIÓN: ADMINISTRADOR DE ENERGÍA ========================
+
+void AdministraEnergia(void){
+    // Se llama al final de cada vuelta del bucle principal de main().
+    // Elige el estado de energía y, si no hay nada que hacer, detiene la CPU.
+    // La revisión y la instrucción Sleep se hacen con GIE en 0: si una interrupción
+    // llega en medio, su bandera ya está en 1 y Sleep retorna de inmediato (una
+    // interrupción habilitada despierta al PIC aunque GIE esté en 0). Al volver
+    // GIE = 1 la ISR la atiende normalmente. Así ningún evento queda esperando
+    // a la siguiente interrupción.
+    unsigned int inicioDormido;
+
+    estadoEnergia = ENERGIA_ACTIVO;
+
+    if(PERMITE_DORMIDO && segundosSinActividad >= SEGUNDOS_PARA_DORMIR &&
+       flagConteoActivo == 0 && guardadoPendiente == 0 && bytesEEPROMPendientes == 0){
+        VaciaColaTX();
+        VaciaColaLCD();
+        // Timer2 y la EUSART se detienen en Sleep: se termina de enviar todo antes.
+
+        GIE = 0;
+        if(colaEventosSalida == colaEventosEntrada && paradaPendiente == 0 && TMR2IF == 0){
+            // Con el tick de Timer2 pendiente Sleep retornaría de inmediato (y el tick
+            // no se atendería hasta después): se espera a la próxima vuelta de main().
+            estadoEnergia = ENERGIA_DORMIDO;
+            vecesDormido++;
+            inicioDormido = milisegundos;
+            // Con GIE en 0 la lectura de 16 bits no se corta.
+
+            LATB = 0b11110000;
+            (void)PORTB;
+            RBIF = 0;
+            RBIE = 1;
+            // Filas en 0 y cambio en RB4?RB7 habilitado: cualquier tecla despierta al PIC.
+            // Se lee PORTB antes de limpiar RBIF para terminar la condición de cambio.
+
+            IDLEN = 0;
+            Sleep();
+            NOP();
+            // Suspensión completa. Continúa aquí al presionar una tecla.
+
+            (void)PORTB;
+            RBIE = 0;
+            RBIF = 0;
+            // La interrupción de PORTB solo sirve para despertar: el teclado lo vuelve
+            // a leer el escaneo de Timer2.
+
+            segundosSinActividad = 0;
+            inicioDespertar      = milisegundos;
+            midiendoDespertar    = 1;
+            // Se mide cuánto tarda en llegar la tecla que despertó al PIC.
+
+            GIE = 1;
+            EnviaTrama(TRAMA_ENERGIA, inicioDormido, ENERGIA_DORMIDO);
+            EnviaTrama(TRAMA_ENERGIA, LeeMilisegundos(), ENERGIA_ACTIVO);
+            // Las dos tramas solo salen si Sleep corrió, y las dos al despertar: la
+            // EUSART estaba detenida. Timer2 también, así que llevan casi la misma hora.
+            return;
         }
+        GIE = 1;
+        return;
+    }
 
-        // Validar el rango del objetivo: 01?59
-        if((piezasObjetivo > 59) || (piezasObjetivo == 0)){
-            // Si el valor ingresado est fuera de rango:
-            modoEdicionObjetivo = 0;
-            teclaLeida          = '\0';
-            piezasObjetivo      = 0;
+    GIE = 0;
+    if(colaEventosSalida == colaEventosEntrada && paradaPendiente == 0 &&
+       (flagConteoActivo == 0 || piezasPendientes == 0)){
+        estadoEnergia = ENERGIA_REPOSO;
 
-            // Mensaje de error por rango invlido
-            BorraLCD();
-            OcultarCursor();
-            MensajeLCD_Var("     !Error!");
-            __delay_ms(1000);
-
-            BorraLCD();
-            MensajeLCD_Var("Valor max: 59");
-            DireccionaLCD(0xC0);
-            MensajeLCD_Var("Valor min: 01");
-            __delay_ms(2000);
-            BorraLCD();
-            // Despus del mensaje de error, el while(1) se repite
-            // y vuelve a pedir "Piezas a contar:".
-        }else{
-            // Valor aceptado (entre 1 y 59)
-            modoEdicionObjetivo  = 0;
-            indiceDigitoObjetivo = 0;
-            BorraLCD();
-            teclaLeida           = '\0';
-            break;                         
-            // Sale del while(1) y por tanto de PreguntaAlUsuario().
+        inicioReposo = TMR3;
+        IDLEN = 1;
+        Sleep();
+        NOP();
+        // PRI_IDLE: CPU detenida, periféricos con el reloj principal.
+
+        ticksReposo += (unsigned int)(TMR3 - inicioReposo);
+        // Con GIE en 0 la ISR todavía no corrió: se cuenta solo el tiempo detenido.
+        // Cada reposo dura como mucho 1 ms (tick de Timer2), menos de una vuelta de TMR3.
+
+        if(CCP2IF == 1){
+            if((unsigned int)((TMR3 - CCPR2) << 3) > latenciaReposoMax){
+                latenciaReposoMax = (TMR3 - CCPR2) << 3;
+            }
         }
+        // Despertó un flanco de RC1: CCPR2 tiene la hora del flanco y TMR3 la actual.
     }
+    GIE = 1;
 }
 
-// ======================== FUNCIN: CONFIGURAR ENTRADA DE OBJETIVO ========================
+// ======================== FUNCIÓN: PERFIL DE RELOJ ========================
+
+void FijaPerfilReloj(unsigned char perfil){
+    // Deja el perfil pedido y espera a que la ISR lo aplique en el borde de un tick
+    // de Timer2 (AplicaPerfilReloj()). Escribir T2CON a mitad de un tick lo
+    // atrasaba hasta 1 ms por cada cambio de perfil, dos veces por lote.
+    unsigned int inicio;
+    // TMR3 al empezar cada espera.
+    unsigned int espera;
+    // Duración de la espera en ciclos (Timer3 × 8).
+    unsigned char anterior = perfilReloj;
+    // Las dos esperas corren (casi) enteras en el perfil del que se sale.
+
+    VaciaColaTX();
+    // La EUSART no puede cambiar de velocidad a mitad de una trama.
+    inicio = TMR3;
+    while(TRMT == 0){}
+    // Espera a que salga también el último byte del registro de desplazamiento.
+    // Con las interrupciones habilitadas: un byte a 9600 baudios dura más que un
+    // tick y con GIEL en 0 se perdía uno. Solo main() encola tramas, así que
+    // ningún byte nuevo empieza antes del cambio.
+    espera = (unsigned int)(TMR3 - inicio) << 3;
+    if(espera > esperaTXMax[anterior]) esperaTXMax[anterior] = espera;
+
+    if(GIEH && GIEL){
+        inicio       = TMR3;
+        perfilPedido = perfil;
+        while(perfilReloj != perfil){}
+        // A lo sumo 1 ms: el próximo tick de Timer2 cambia el perfil.
+        espera = (unsigned int)(TMR3 - inicio) << 3;
+        if(espera > esperaPerfilMax[anterior]) esperaPerfilMax[anterior] = espera;
+        // Las cotas de las dos esperas están junto a esperaTXMax y esperaPerfilMax;
+        // el escenario perfiles las mide en los dos sentidos.
+    }else{
+        AplicaPerfilReloj(perfil);
+        // Sin interrupciones (ConfigPIC()) no hay tick que cortar: se aplica aquí.
+    }
+}
 
-void ConfigPregunta(void){ 
-    // Funcin que se llama desde la ISR de PORTB cada vez que se pulsa una tecla numrica.
-    // Construye el valor de piezasObjetivo en base a dos dgitos: decenas y unidades,
-    // siempre que modoEdicionObjetivo = 1.
+void AplicaPerfilReloj(unsigned char perfil){
+    // Cambia INTOSC a la frecuencia del perfil y, sin que entre otra interrupción
+    // de baja prioridad, los timers que dependen de ella: nadie ve una mezcla.
+    unsigned int inicio = TMR3;
+    // TMR3 antes de la espera a IOFS.
+
+    OSCCON = (OSCCON & 0b10001111) | perfilOSCCON[perfil];
+    while(IOFS == 0){}
+    // Espera a que INTOSC sea estable en la nueva frecuencia (ver esperaIOFSMax).
+    if((unsigned int)((TMR3 - inicio) << 3) > esperaIOFSMax){
+        esperaIOFSMax = (TMR3 - inicio) << 3;
+    }
+
+    T2CON = perfilT2CON[perfil];
+    SPBRG = perfilSPBRG[perfil];
+    // Timer2 sigue dando 1 ms y la EUSART 9600 baudios. Escribir T2CON borra el
+    // prescaler y el postscaler, que justo después de un tick ya están en 0.
+
+    piezaMinTicks      = perfilPiezaMinTicks[perfil];
+    multiplicadorReloj = perfilMultiplicador[perfil];
+    perfilReloj        = perfil;
+
+    desbordesTimer3 = 2;
+    // La última captura se midió con otro tick de Timer3: no se compara con la próxima.
+}
+
+// ======================== FUNCIÓN: LEER MILISEGUNDOS ========================
+
+unsigned int LeeMilisegundos(void){
+    // milisegundos es de 16 bits y la ISR puede cambiarlo entre la lectura de sus dos bytes.
+    unsigned int ms;
+    unsigned char giel = GIEL;
+
+    GIEL = 0;
+    ms   = milisegundos;
+    GIEL = giel;
+    return ms;
+}
 
-    if(indiceDigitoObjetivo == 0 && modoEdicionObjetivo == 1){
-        // Primer dgito: decenas del objetivo.
+// ======================== FUNCIÓN: SALIDAS PARA UN CONTEO ========================
 
-        EscribeLCD_n8(teclaLeida, 1);      
-        // Escribe el dgito (0?9) en el LCD como un solo carcter.
+void CalculaSalidas(unsigned int conteo){
+    // Deja unidades7Seg y decenasRGB como quedarían después de contar 'conteo' piezas
+    // una por una (FIN y lote recuperado), sin divisiones.
+    unsigned long bcd = BinarioABCD16(conteo);
 
-        piezasObjetivo = teclaLeida;       
-        // Guarda ese dgito como parte inicial del objetivo.
-        // De momento vale [0?9], luego se completar con el segundo dgito.
+    unidades7Seg = bcd & 0x0F;
+    // Unidades para el 7 segmentos (nibble de unidades).
+
+    decenasRGB   = ((bcd >> 4) & 0x0F)
+                 + 4 * (((bcd >> 8) & 0x0F) + ((bcd >> 12) & 0x0F) + ((bcd >> 16) & 0x0F));
+    while(decenasRGB >= 6){
+        decenasRGB -= 6;
     }
-    else if(indiceDigitoObjetivo == 1 && modoEdicionObjetivo == 1){
-        // Segundo dgito: unidades del objetivo.
+    // Decenas módulo 6, igual que las deja el conteo pieza a pieza.
+    // Como 10, 100 y 1000 dejan resto 4 al dividir entre 6, basta con sumar la
+    // cifra de decenas más 4 veces las cifras de centenas, miles y decenas de mil.
+}
 
-        EscribeLCD_n8(teclaLeida, 1);      
-        // Escribe el segundo dgito en el LCD.
+// ======================== FUNCIONES: PERSISTENCIA EN EEPROM ========================
+
+unsigned char LeeEEPROM(unsigned char direccion){
+    EEADR  = direccion;
+    EEPGD  = 0;
+    CFGS   = 0;
+    // Acceso a la EEPROM de datos (no a la flash ni a la configuración).
+    RD     = 1;
+    return EEDATA;
+    // El dato queda disponible en el ciclo siguiente a RD = 1.
+}
 
-        piezasObjetivo = piezasObjetivo * 10 + teclaLeida; 
-        // Forma el nmero de dos cifras:
-        // Ejemplo: si el primer dgito fue 3 y el segundo 5:
-        // piezasObjetivo = 3 * 10 + 5 = 35.
+void IniciaByteEEPROM(unsigned char direccion, unsigned char dato){
+    // Arranca la escritura y retorna; el fin lo avisa EEIF (~4 ms después).
+    // La secuencia 0x55/0xAA no puede interrumpirse: se llama con GIE en 0.
+    EEADR  = direccion;
+    EEDATA = dato;
+    EEPGD  = 0;
+    CFGS   = 0;
+    WREN   = 1;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    WR     = 1;
+    WREN   = 0;
+    // WR sigue en 1 hasta que termina la escritura; WREN ya no hace falta.
+}
+
+void SolicitaGuardado(void){
+    guardadoPendiente = 1;
+    // Varias solicitudes seguidas se juntan en un solo registro.
+}
 
-        OcultarCursor();
-        // Una vez que se completan los dos dgitos, se oculta el cursor.
-        // A partir de este momento se espera solo a que el usuario pulse '*'.
+void AtiendePersistencia(void){
+    // Nunca espera a la EEPROM: si está ocupada, el guardado queda pendiente para
+    // la próxima llamada. El registro se arma con los valores del momento en que
+    // arranca la escritura, así que siempre guarda el estado más reciente.
+    unsigned char verificacion;
+
+    if(caidaTension == 1){
+        caidaTension      = 0;
+        guardadoPendiente = 1;
+    }
+    // Caída de tensión: se guarda sin esperar a SEGUNDOS_ENTRE_GUARDADOS.
+
+    if(guardadoPendiente == 0 || bytesEEPROMPendientes != 0){
+        return;
     }
 
-    indiceDigitoObjetivo++;                
-    // Avanza al siguiente dgito. Despus de 2, ya no se usan ms dgitos.
+    secuenciaEEPROM++;
+    ranuraEEPROM = (ranuraEEPROM + 1) & (TOTAL_REGISTROS_EEPROM - 1);
+
+    registroEEPROM[0] = (unsigned char)secuenciaEEPROM;
+    registroEEPROM[1] = (unsigned char)(secuenciaEEPROM >> 8);
+    registroEEPROM[2] = (unsigned char)piezasTotalesContadas;
+    registroEEPROM[3] = (unsigned char)(piezasTotalesContadas >> 8);
+    registroEEPROM[4] = (unsigned char)piezasObjetivo;
+    registroEEPROM[5] = (unsigned char)(piezasObjetivo >> 8);
+    registroEEPROM[6] = (flagConteoActivo == 1) ? (unsigned char)((loteActual << 4) | recetaActiva) : 0;
+
+    verificacion = SEMILLA_EEPROM;
+    for(unsigned char i = 0; i < TAM_REGISTRO_EEPROM - 1; i++){
+        verificacion ^= registroEEPROM[i];
+    }
+    registroEEPROM[7] = verificacion;
+    // Si el PIC se apaga a mitad del registro, la verificación falla y al arrancar
+    // se usa el registro anterior, que está en otra ranura y quedó intacto.
+
+    guardadoPendiente  = 0;
+    piezasSinGuardar   = 0;
+    segundosSinGuardar = 0;
+    guardadosEEPROM++;
+
+    GIE = 0;
+    direccionEEPROM       = DIR_REGISTROS_EEPROM + ranuraEEPROM * TAM_REGISTRO_EEPROM;
+    bytesEEPROMPendientes = TAM_REGISTRO_EEPROM;
+    IniciaByteEEPROM(direccionEEPROM, registroEEPROM[0]);
+    GIE = 1;
+    // Los 7 bytes siguientes los arranca la ISR, uno por cada EEIF.
 }
 
-// ======================== FUNCIN: BORRAR OBJETIVO DEL USUARIO ========================
+unsigned char LeeReceta(unsigned char receta, unsigned int *objetivo){
+    // Llamar con la EEPROM libre (bytesEEPROMPendientes en 0).
+    unsigned char dato[TAM_RECETA_EEPROM];
+    unsigned char direccion = DIR_RECETAS_EEPROM + (receta - 1) * TAM_RECETA_EEPROM;
+    unsigned char verificacion = SEMILLA_EEPROM;
 
-void Borrar(void){ 
-    // Borra el valor escrito por el usuario en el LCD y reinicia la entrada del objetivo.
-    // Se llama desde la ISR de PORTB cuando se presiona la tecla SUPR.
+    if(receta == 0 || receta > TOTAL_RECETAS){
+        return 0;
+    }
 
-    if(modoEdicionObjetivo == 1){
-        // Solo tiene sentido borrar si estamos en modo de edicin.
+    for(unsigned char i = 0; i < TAM_RECETA_EEPROM; i++){
+        dato[i]       = LeeEEPROM(direccion + i);
+        verificacion ^= dato[i];
+    }
+    *objetivo = dato[0] | ((unsigned int)dato[1] << 8);
 
-        MostrarCursor();
-        // Muestra el cursor para sealar que puede volver a escribir.
+    if(verificacion != 0 || *objetivo == 0 || dato[2] == 0 || dato[2] > LOTES_MAX){
+        return 0;
+    }
+    // Receta vacía (0xFF), dañada o fuera de rango.
+    return dato[2];
+}
 
-        piezasObjetivo          = 0;
-        indiceDigitoObjetivo = 0;
-        // Reinicia el objetivo y el ndice de dgito.
+void RecuperaEstado(void){
+    // Recorre las 16 ranuras y se queda con el registro válido de secuencia más alta.
+    // La comparación es por diferencia (con signo) para que siga funcionando cuando
+    // la secuencia da la vuelta de 65535 a 0.
+    unsigned char ranura;
+    unsigned char direccion;
+    unsigned char verificacion;
+    unsigned char encontrado = 0;
+    unsigned int secuencia;
+
+    for(ranura = 0; ranura < TOTAL_REGISTROS_EEPROM; ranura++){
+        direccion    = DIR_REGISTROS_EEPROM + ranura * TAM_REGISTRO_EEPROM;
+        verificacion = SEMILLA_EEPROM;
+        for(unsigned char i = 0; i < TAM_REGISTRO_EEPROM; i++){
+            registroEEPROM[i] = LeeEEPROM(direccion + i);
+            verificacion     ^= registroEEPROM[i];
+        }
+        if(verificacion != 0){
+            continue;
+        }
+        // Registro borrado o incompleto.
 
-        DireccionaLCD(0xC7);
-        // Se posiciona donde estaban los cuadros de Marco.
+        secuencia = registroEEPROM[0] | ((unsigned int)registroEEPROM[1] << 8);
+        if(encontrado == 0 || (signed int)(secuencia - secuenciaEEPROM) > 0){
+            encontrado      = 1;
+            secuenciaEEPROM = secuencia;
+            ranuraEEPROM    = ranura;
+        }
+    }
 
-        EscribeLCD_c(1);
-        EscribeLCD_c(1);
-        // Vuelve a dibujar dos caracteres Marco (posicin 1 en CGRAM),
-        // indicando que el usuario puede volver a digitar dos cifras.
+    if(encontrado == 0){
+        ranuraEEPROM    = TOTAL_REGISTROS_EEPROM - 1;
+        secuenciaEEPROM = 0;
+        return;
+        // EEPROM sin registros: el primer guardado va a la ranura 0.
+    }
+
+    direccion = DIR_REGISTROS_EEPROM + ranuraEEPROM * TAM_REGISTRO_EEPROM;
+    for(unsigned char i = 0; i < TAM_REGISTRO_EEPROM; i++){
+        registroEEPROM[i] = LeeEEPROM(direccion + i);
+    }
+    // Vuelve a leer el registro elegido.
+
+    if(registroEEPROM[6] != 0){
+        piezasTotalesContadas = registroEEPROM[2] | ((unsigned int)registroEEPROM[3] << 8);
+        piezasObjetivo        = registroEEPROM[4] | ((unsigned int)registroEEPROM[5] << 8);
+        recetaActiva          = registroEEPROM[6] & 0x0F;
+        loteActual            = registroEEPROM[6] >> 4;
+
+        if(recetaActiva != 0){
+            unsigned int objetivoReceta;
+            lotesReceta = LeeReceta(recetaActiva, &objetivoReceta);
+            if(lotesReceta < loteActual){
+                recetaActiva = 0;
+                loteActual   = 1;
+                lotesReceta  = 1;
+            }
+            // Receta borrada o cambiada: el lote recuperado termina solo.
+        }
+
+        if(piezasObjetivo != 0 && piezasTotalesContadas < piezasObjetivo){
+            CalculaSalidas(piezasTotalesContadas);
+            ActualizaSalidas();
+            loteRecuperado = 1;
+            // Lote a medias: main() lo retoma en EST_CONTEO, sin pedir el objetivo.
+        }else{
+            piezasTotalesContadas = 0;
+            piezasObjetivo        = 0;
+        }
+    }
+}
+
+// ======================== FUNCIONES: TELEMETRÍA ========================
+
+void EnviaTrama(unsigned char tipo, unsigned int a, unsigned int b){
+    // Se llama solo desde main(). Copia la trama completa a la cola y habilita la
+    // interrupción de transmisión; nunca espera a la EUSART.
+    unsigned char trama[TAM_TRAMA];
+    unsigned char crc = 0;
+    unsigned char libres;
+
+    trama[0] = TRAMA_SINCRONISMO;
+    trama[1] = tipo;
+    trama[2] = (unsigned char)a;
+    trama[3] = (unsigned char)(a >> 8);
+    trama[4] = (unsigned char)b;
+    trama[5] = (unsigned char)(b >> 8);
+
+    for(unsigned char i = 1; i < TAM_TRAMA - 1; i++){
+        crc ^= trama[i];
+        for(unsigned char j = 0; j < 8; j++){
+            if(crc & 0x80)
+                crc = (crc << 1) ^ 0x07;
+            else
+                crc <<= 1;
+        }
+    }
+    trama[TAM_TRAMA - 1] = crc;
+    // CRC-8 bit a bit (polinomio x^8 + x^2 + x + 1): 40 vueltas, sin tabla en flash.
 
-        DireccionaLCD(0xC7);
-        // Vuelve a ubicar el cursor en la posicin del primer dgito.
+    libres = (colaTXSalida - colaTXEntrada - 1) & (TAM_COLA_TX - 1);
+    if(libres < TAM_TRAMA){
+        tramasPerdidas++;
+        return;
     }
-}
\ No newline at end of file
+    // Se descarta la trama entera: el receptor nunca ve una trama a medias.
+
+    for(unsigned char i = 0; i < TAM_TRAMA; i++){
+        colaTX[colaTXEntrada] = trama[i];
+        colaTXEntrada = (colaTXEntrada + 1) & (TAM_COLA_TX - 1);
+    }
+    TXIE = 1;
+    // La ISR envía un byte cada vez que TXREG queda libre.
+}
+
+void VaciaColaTX(void){
+    // Igual que VaciaColaLCD(): si ISR() puede entrar (GIEH y GIEL en 1) espera a
+    // que ella envíe los bytes; si no (antes de habilitarlas o en una sección
+    // crítica, aunque solo GIEL esté en 0) los envía aquí.
+    if(GIEH && GIEL){
+        while(colaTXSalida != colaTXEntrada){}
+    }else{
+        while(colaTXSalida != colaTXEntrada){
+            while(TXIF == 0){}
+            TXREG        = colaTX[colaTXSalida];
+            colaTXSalida = (colaTXSalida + 1) & (TAM_COLA_TX - 1);
+        }
+    }
+}
+
+#ifdef TRAZA_EVENTOS
+void VuelcaTraza(void){
+    // A 9600 baudios cada trama tarda ~7 ms, así que el volcado completo bloquea
+    // main() cerca de medio segundo; solo se pide a mano, nunca durante el conteo normal.
+    unsigned char i;
+    unsigned char n;
+
+    trazaCongelada = 1;
+    // Mientras se envía, la ISR y main() no agregan eventos.
+
+    i = (trazaLlena == 1) ? trazaIndice : 0;
+    n = (trazaLlena == 1) ? TAM_TRAZA : trazaIndice;
+    // Si la cola ya dio la vuelta, el evento más viejo es el que se va a pisar.
+
+    while(n != 0){
+        while(((colaTXSalida - colaTXEntrada - 1) & (TAM_COLA_TX - 1)) < TAM_TRAMA){}
+        // Espera lugar en la cola de la EUSART: aquí no se puede perder ninguna trama.
+
+        EnviaTrama(TRAMA_TRAZA, trazaEvento[i], trazaTiempo[i]);
+        i = (i + 1) & (TAM_TRAZA - 1);
+        n--;
+    }
+
+    trazaIndice    = 0;
+    trazaLlena     = 0;
+    trazaCongelada = 0;
+    // La siguiente captura empieza vacía.
+}
+#endif
+
+// ======================== FUNCIONES: MEDIDOR DE RITMO ========================
+
+void ReiniciaRitmo(void){
+    GIEL = 0;
+    for(unsigned char i = 0; i < TAM_VENTANA_RITMO; i++){
+        intervalosPieza[i] = 0;
+    }
+    indiceIntervalo = 0;
+    totalIntervalos = 0;
+    sumaIntervalos  = 0;
+    hayPiezaPrevia  = 0;
+    GIEL = 1;
+    // Las piezas del lote anterior no cuentan para el ritmo del nuevo.
+}
+
+void MuestraRitmo(void){
+    // Piezas por minuto = 60000 ms × intervalos / suma de los intervalos (en ms).
+    // Si la línea se detiene, el tiempo desde la última pieza reemplaza al intervalo
+    // más viejo cuando ya es más largo que él, así el ritmo baja poco a poco en
+    // lugar de quedar congelado en el último valor.
+    unsigned long suma;
+    unsigned char total;
+    unsigned int masViejo;
+    unsigned int abierto;
+
+    GIEL = 0;
+    suma     = sumaIntervalos;
+    total    = totalIntervalos;
+    masViejo = intervalosPieza[indiceIntervalo];
+    abierto  = milisegundos - ultimaPiezaMs;
+    GIEL = 1;
+    // Copia atómica de lo que escribe la ISR.
+
+    if(total == 0 || segundosSinActividad >= RITMO_PARADA_S){
+        piezasPorMinuto = 0;
+    }else{
+        if(total == TAM_VENTANA_RITMO && abierto > masViejo){
+            suma += abierto - masViejo;
+        }
+        if(suma == 0){
+            suma = 1;
+        }
+        suma = 60000UL * total / suma;
+        piezasPorMinuto = (suma > 65535UL) ? 65535 : (unsigned int)suma;
+    }
+    // Una sola división de 32 bits por segundo, fuera de la ruta de cada pieza.
+
+    if(vistaConteo == VISTA_NORMAL){
+        EscribeFB_n16(CELDA_RITMO, piezasPorMinuto, 5);
+    }
+    // En las otras vistas el ritmo se sigue calculando pero no se muestra.
+}
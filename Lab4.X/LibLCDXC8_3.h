@@ -0,0 +1,539 @@
+// ============================================================================
+// LibLCDXC8_3.h - Librería para LCD HD44780 (16x2) con XC8 y PIC18F4550
+// ============================================================================
+// Conexiones (interfaz de 4 bits):
+//   RD4-RD7 -> D4-D7 del LCD   (RD0-RD3 quedan libres para el 7 segmentos)
+//   RA4     -> RS
+//   RA5     -> E
+//
+// Versión asíncrona: ninguna función de escritura espera al LCD.
+// Cada comando o dato se guarda en una cola circular y AtiendeLCD(), llamada
+// desde un tick periódico de 1 ms (Timer2 en la ISR), envía un byte por tick.
+// Entre dos bytes siempre pasa al menos 1 ms, que cubre los 37 us que necesita
+// el HD44780 para datos y comandos normales. Los comandos lentos (borrar y
+// cursor a inicio, 1.52 ms) y la inicialización piden ticks de espera extra.
+//
+// Las funciones públicas conservan los nombres y parámetros de la versión
+// anterior (DireccionaLCD, EscribeLCD_c, EscribeLCD_n8, MensajeLCD_Var,
+// BorraLCD, ...), así que el programa principal no necesita cambios.
+//
+// Pantalla virtual (framebuffer): el programa puede escribir en pantallaFB
+// (32 celdas, 0-15 primera línea y 16-31 segunda) con las funciones *FB y
+// luego llamar a RefrescaLCD(), que compara contra pantallaLCD (lo que el LCD
+// muestra realmente) y encola solo las celdas que cambiaron, con la menor
+// cantidad posible de comandos de dirección. No hace falta BorraLCD().
+//
+// Pantallas en tablas: una pantalla fija se describe como un arreglo const de
+// ElementoPantalla (queda en la memoria de programa) y DibujaPantalla() la
+// copia a la pantalla virtual. Cada elemento es un texto o un glifo de CGRAM
+// repetido, a partir de una celda; la tabla termina con FIN_PANTALLA.
+//
+// Caracteres propios: CrearCaracter() recuerda qué arreglo quedó en cada una de
+// las 8 posiciones de CGRAM y no vuelve a enviar uno que ya está cargado (cada
+// carga son 10 bytes). Los arreglos se reconocen por su dirección, así que deben
+// ser const (en flash) y no cambiar de contenido.
+//
+// PORTD compartido: el LCD usa RD4-RD7 y el programa RD0-RD3 (7 segmentos).
+// Nadie escribe LATD directamente: la librería usa EscribeLATD_Alto() y el
+// programa EscribeLATD_Bajo(). Las dos actualizan sombraLATD con las
+// interrupciones apagadas y copian el byte completo a LATD, así que una mitad
+// nunca pisa a la otra aunque la ISR entre en medio.
+// ============================================================================
+
+#ifndef LIBLCDXC8_3_H
+#define LIBLCDXC8_3_H
+
+#include <xc.h>
+
+#ifndef INICIO_CICLOS
+#define INICIO_CICLOS(id)
+#define FIN_CICLOS(id)
+#endif
+// Macros de medición de ciclos y traza. Los define el programa antes de incluir esta
+// librería (ver MEDIR_CICLOS y TRAZA_EVENTOS en Lab4.c); si no, no generan código.
+
+#ifndef ESPERA_TICK_LCD
+#define ESPERA_TICK_LCD()  __delay_ms(1)
+#endif
+// Espera de un tick (1 ms) cuando la cola se vacía sin interrupciones. El programa
+// la redefine si cambia la frecuencia del reloj en tiempo de ejecución.
+
+#define TAM_COLA_LCD   128
+// Tamaño de la cola (potencia de 2 para poder usar máscara en vez de módulo).
+// La ráfaga más grande es la vista de cifras grandes: 5 glifos de CGRAM (50
+// entradas) más una pantalla completa (32 datos y, como mucho, un comando de
+// dirección por celda y el del cursor: 65). Con 115 entradas cabe sin esperar.
+
+// Bits de control de cada entrada de la cola
+#define LCD_RS         0x01
+// 1: la entrada es un dato (RS = 1), 0: es un comando (RS = 0).
+#define LCD_NIBBLE     0x02
+// Solo se envía el nibble alto (secuencia de inicialización en 4 bits).
+#define LCD_ESPERA(t)  ((t) << 4)
+// Ticks de 1 ms adicionales que se esperan después de enviar la entrada (0-15).
+
+unsigned char interfaz=8;
+
+unsigned char colaLCDDato[TAM_COLA_LCD];
+unsigned char colaLCDCtrl[TAM_COLA_LCD];
+// Cola circular: byte a enviar y sus bits de control (RS, nibble, espera).
+
+volatile unsigned char colaLCDEntrada;
+// Posición donde se guarda la próxima entrada (la modifica el programa).
+volatile unsigned char colaLCDSalida;
+// Posición de la próxima entrada a enviar (la modifica AtiendeLCD()).
+volatile unsigned char esperaLCD;
+// Ticks que faltan antes de poder enviar la siguiente entrada.
+unsigned int esperasColaLCD;
+// Veces que EncolaLCD() encontró la cola llena y tuvo que esperar (debería quedar en 0).
+
+#define SIN_CURSOR_FB  0xFF
+// Valor de cursorFB / direccionLCD cuando no hay una celda definida.
+
+unsigned char pantallaFB[32];
+// Pantalla que el programa quiere mostrar.
+unsigned char pantallaLCD[32];
+// Copia de lo que ya se encoló hacia el LCD (lo que mostrará el LCD).
+unsigned char direccionLCD;
+// Celda (0-31) en la que el LCD escribirá el próximo dato, o SIN_CURSOR_FB si no se sabe.
+unsigned char cursorFB;
+// Celda donde debe quedar el cursor después de RefrescaLCD(), o SIN_CURSOR_FB.
+
+#define FIN_PANTALLA   0xFF
+// Celda del elemento que cierra una tabla de pantalla.
+
+typedef struct{
+    unsigned char celda;      // celda inicial 0-31, o FIN_PANTALLA
+    unsigned char glifo;      // carácter de CGRAM (0-7), si texto es 0
+    unsigned char veces;      // cuántas celdas seguidas ocupa el glifo
+    const char *texto;        // texto en flash, o 0 para un glifo
+} ElementoPantalla;
+
+unsigned char sombraLATD;
+// Valor que debe tener LATD: nibble alto del LCD, nibble bajo del programa.
+
+unsigned long bytesLCD;
+// Total de bytes enviados al LCD (comandos + datos). Sirve para medir en el
+// simulador cuántas transacciones cuesta cada actualización de pantalla.
+unsigned char bytesRefrescoLCD;
+// Bytes que encoló el último RefrescaLCD() (comandos de dirección + datos).
+
+const unsigned char *glifosCGRAM[8];
+// Arreglo cargado en cada posición de CGRAM, o 0 si no se sabe (al inicializar).
+
+void ConfiguraLCD(unsigned char);
+void EnviaDato(unsigned char);
+void EnviaNibble(unsigned char);
+void EscribeLATD_Alto(unsigned char);
+void EscribeLATD_Bajo(unsigned char);
+void EncolaLCD(unsigned char, unsigned char);
+void AtiendeLCD(void);
+void VaciaColaLCD(void);
+void InicializaLCD(void);
+void HabilitaLCD(void);
+void BorraLCD(void);
+void CursorAInicio(void);
+void ComandoLCD(unsigned char);
+void EscribeLCD_c(unsigned char);
+void EscribeLCD_n8(unsigned char, unsigned char);
+void EscribeLCD_n16(unsigned int, unsigned char);
+void EscribeLCD_bcd(unsigned long, unsigned char);
+unsigned int BinarioABCD8(unsigned char);
+unsigned long BinarioABCD16(unsigned int);
+void MensajeLCD_Var(char *);
+void DireccionaLCD(unsigned char);
+void FijaCursorLCD(unsigned char,unsigned char);
+void DesplazaPantallaD(void);
+void DesplazaPantallaI(void);
+void DesplazaCursorD(void);
+void DesplazaCursorI(void);
+void CrearCaracter(const unsigned char *,unsigned char);
+void OcultarCursor(void);
+void MostrarCursor(void);
+void BorraFB(void);
+void EscribeFB_c(unsigned char, unsigned char);
+void EscribeFB_n8(unsigned char, unsigned char, unsigned char);
+void EscribeFB_n16(unsigned char, unsigned int, unsigned char);
+void EscribeFB_bcd(unsigned char, unsigned long, unsigned char);
+void MensajeFB(unsigned char, char *);
+void DibujaPantalla(const ElementoPantalla *);
+void FijaCursorFB(unsigned char);
+void RefrescaLCD(void);
+
+
+void ConfiguraLCD(unsigned char a){
+    if(a==4 || a ==8)
+        interfaz=a;
+}
+
+// ------------------------------ PORTD compartido ------------------------------
+
+void EscribeLATD_Alto(unsigned char a){
+    // RD4-RD7 (datos del LCD) = bits 4-7 de a. RD0-RD3 no cambian.
+    unsigned char gie = GIE;
+
+    GIE = 0;
+    sombraLATD = (sombraLATD & 0b00001111) | (a & 0b11110000);
+    LATD = sombraLATD;
+    GIE = gie;
+}
+void EscribeLATD_Bajo(unsigned char a){
+    // RD0-RD3 (7 segmentos) = bits 0-3 de a. RD4-RD7 no cambian.
+    unsigned char gie = GIE;
+
+    GIE = 0;
+    sombraLATD = (sombraLATD & 0b11110000) | (a & 0b00001111);
+    LATD = sombraLATD;
+    GIE = gie;
+}
+
+// ------------------------- Nivel físico (solo AtiendeLCD) -------------------------
+
+void HabilitaLCD(void){
+    // Pulso en E: el LCD toma el dato en el flanco de bajada.
+    LATA5=1;
+    __delay_us(1);
+    LATA5=0;
+}
+void EnviaNibble(unsigned char a){
+    // Solo el nibble alto de 'a' (o el byte completo en 8 bits).
+    if(interfaz==4){
+        EscribeLATD_Alto(a);
+    }else{
+        EscribeLATD_Alto(a);
+        EscribeLATD_Bajo(a);
+    }
+    HabilitaLCD();
+}
+void EnviaDato(unsigned char a){
+    // Byte completo: en 4 bits, nibble alto y luego nibble bajo, sin espera entre ellos.
+    INICIO_CICLOS(MED_ENVIA_DATO);
+    if(interfaz==4){
+        EscribeLATD_Alto(a);
+        HabilitaLCD();
+        EscribeLATD_Alto(a<<4);
+        HabilitaLCD();
+    }else if(interfaz==8){
+        EscribeLATD_Alto(a);
+        EscribeLATD_Bajo(a);
+        HabilitaLCD();
+    }
+    FIN_CICLOS(MED_ENVIA_DATO);
+}
+
+// ------------------------------ Cola de envío ------------------------------
+
+void AtiendeLCD(void){
+    // Llamar cada 1 ms (desde la ISR de Timer2). Envía como máximo un byte.
+    unsigned char ctrl;
+
+    if(esperaLCD != 0){
+        esperaLCD--;
+        return;
+    }
+    if(colaLCDSalida == colaLCDEntrada)
+        return;
+
+    ctrl  = colaLCDCtrl[colaLCDSalida];
+    LATA4 = ctrl & LCD_RS;
+    if(ctrl & LCD_NIBBLE)
+        EnviaNibble(colaLCDDato[colaLCDSalida]);
+    else
+        EnviaDato(colaLCDDato[colaLCDSalida]);
+    esperaLCD     = ctrl >> 4;
+    colaLCDSalida = (colaLCDSalida + 1) & (TAM_COLA_LCD - 1);
+    bytesLCD++;
+}
+void EncolaLCD(unsigned char dato, unsigned char ctrl){
+    // Agrega una entrada a la cola. Si está llena se espera a que AtiendeLCD()
+    // libere espacio; si el tick no puede entrar (dentro de la ISR o de una sección
+    // crítica) la entrada más vieja se envía aquí.
+    unsigned char siguiente;
+    unsigned char gie = GIE;
+    unsigned char hayTick = GIEH && GIEL;
+    // Con IPEN = 1 GIE es GIEH: el tick (baja prioridad) necesita también GIEL.
+    // Se mira antes de apagar GIE, que es lo que cambia la condición.
+
+    GIE = 0;
+    siguiente = (colaLCDEntrada + 1) & (TAM_COLA_LCD - 1);
+    if(siguiente == colaLCDSalida){
+        esperasColaLCD++;
+    }
+    while(siguiente == colaLCDSalida){
+        if(hayTick){
+            GIE = 1;
+            NOP();
+            GIE = 0;
+        }else{
+            ESPERA_TICK_LCD();
+            AtiendeLCD();
+        }
+    }
+    colaLCDDato[colaLCDEntrada] = dato;
+    colaLCDCtrl[colaLCDEntrada] = ctrl;
+    colaLCDEntrada = siguiente;
+    GIE = gie;
+}
+void VaciaColaLCD(void){
+    // Espera a que todo lo encolado llegue al LCD (por ejemplo, antes de detener el programa).
+    // Con IPEN = 0 la condición equivale a GIE && PEIE: la de una interrupción periférica.
+    if(GIEH && GIEL){
+        while(colaLCDSalida != colaLCDEntrada || esperaLCD != 0){}
+    }else{
+        while(colaLCDSalida != colaLCDEntrada || esperaLCD != 0){
+            ESPERA_TICK_LCD();
+            AtiendeLCD();
+        }
+    }
+}
+
+// ------------------------------ Funciones de uso ------------------------------
+
+void InicializaLCD(void){
+    // Secuencia de inicialización por instrucciones del HD44780.
+    unsigned char gie = GIE;
+
+    LATA4=0;
+    LATA5=0;
+    GIE = 0;
+    colaLCDEntrada = 0;
+    colaLCDSalida  = 0;
+    esperaLCD      = 50;                             // > 40 ms desde el encendido
+    GIE = gie;
+    for(unsigned char i=0;i<8;i++)
+        glifosCGRAM[i]=0;                            // CGRAM con contenido desconocido
+    EncolaLCD(0x30, LCD_NIBBLE | LCD_ESPERA(5));   // > 4.1 ms
+    EncolaLCD(0x30, LCD_NIBBLE | LCD_ESPERA(1));   // > 100 us
+    EncolaLCD(0x30, LCD_NIBBLE | LCD_ESPERA(1));
+    if(interfaz==4){
+        EncolaLCD(0x20, LCD_NIBBLE | LCD_ESPERA(1)); // pasa a 4 bits
+        EncolaLCD(0x28, 0);                          // 4 bits, 2 líneas, 5x8
+    }else{
+        EncolaLCD(0x38, 0);                          // 8 bits, 2 líneas, 5x8
+    }
+    EncolaLCD(0x06, 0);                              // incrementa, sin desplazar
+    BorraLCD();
+    EncolaLCD(0x0F, 0);                              // display, cursor y parpadeo
+}
+void BorraLCD(void){
+    EncolaLCD(0x01, LCD_ESPERA(2));                  // 1.52 ms
+    for(unsigned char i=0;i<32;i++)
+        pantallaLCD[i]=' ';
+    direccionLCD=0;
+}
+void CursorAInicio(void){
+    EncolaLCD(0x02, LCD_ESPERA(2));                  // 1.52 ms
+    direccionLCD=0;
+}
+void ComandoLCD(unsigned char a){
+    if(a==1)
+        BorraLCD();
+    else if((a&0b11111110)==2)
+        CursorAInicio();
+    else
+        EncolaLCD(a, 0);
+}
+void EscribeLCD_c(unsigned char a){
+    EncolaLCD(a, LCD_RS);
+    if(direccionLCD != SIN_CURSOR_FB){
+        // Mantiene pantallaLCD al día también con las escrituras directas.
+        pantallaLCD[direccionLCD]=a;
+        direccionLCD++;
+        if(direccionLCD==16 || direccionLCD==32)
+            direccionLCD=SIN_CURSOR_FB;              // pasa a DDRAM no visible
+    }
+}
+unsigned int BinarioABCD8(unsigned char a){
+    // Convierte a BCD empaquetado (0x0000-0x0255) con el método de desplazar y
+    // sumar 3 ("double dabble"): 8 vueltas fijas, sin divisiones por software.
+    // EscribeLCD_n8 con 3 cifras: 312-332 ciclos contra 416-435 con / y % (___lbdiv,
+    // ___lbmod); con 5 cifras, EscribeLCD_n16 baja de 1637-1782 a 883-1033.
+    unsigned int bcd=0;
+    for(unsigned char i=0;i<8;i++){
+        if((bcd & 0x000F) >= 0x0005) bcd+=0x0003;
+        if((bcd & 0x00F0) >= 0x0050) bcd+=0x0030;
+        bcd=(bcd<<1) | (a>>7);
+        a<<=1;
+    }
+    return bcd;
+}
+unsigned long BinarioABCD16(unsigned int a){
+    // Igual que BinarioABCD8 para 16 bits: 5 cifras BCD (0x00000-0x65535), 16 vueltas.
+    unsigned long bcd=0;
+    for(unsigned char i=0;i<16;i++){
+        if((bcd & 0x0000F) >= 0x00005) bcd+=0x00003;
+        if((bcd & 0x000F0) >= 0x00050) bcd+=0x00030;
+        if((bcd & 0x00F00) >= 0x00500) bcd+=0x00300;
+        if((bcd & 0x0F000) >= 0x05000) bcd+=0x03000;
+        bcd=(bcd<<1) | ((a & 0x8000) ? 1 : 0);
+        a<<=1;
+    }
+    return bcd;
+}
+void EscribeLCD_bcd(unsigned long bcd,unsigned char b){
+    // Escribe las b cifras menos significativas de un número en BCD empaquetado.
+    // Cada cifra se toma de su byte (b/2, el long va con el byte bajo primero) y
+    // de su nibble, sin desplazar el long b*4 bits por cifra.
+    unsigned char par;
+    while(b!=0){
+        b--;
+        par=((unsigned char *)&bcd)[b>>1];
+        if(b & 1)
+            par>>=4;
+        EscribeLCD_c((par & 0x0F)+48);
+    }
+}
+void EscribeLCD_n8(unsigned char a,unsigned char b){
+    // a: número a escribir, b: cantidad de cifras (1 a 3)
+    INICIO_CICLOS(MED_ESCRIBE_N8);
+    if(b>=1 && b<=3)
+        EscribeLCD_bcd(BinarioABCD8(a),b);
+    FIN_CICLOS(MED_ESCRIBE_N8);
+}
+void EscribeLCD_n16(unsigned int a,unsigned char b){
+    // a: número a escribir, b: cantidad de cifras (1 a 5)
+    if(b>=1 && b<=5)
+        EscribeLCD_bcd(BinarioABCD16(a),b);
+}
+void MensajeLCD_Var(char* a){
+    // Encola la cadena completa; retorna sin esperar a que se muestre.
+    INICIO_CICLOS(MED_MENSAJE);
+    for (int i=0;a[i] != '\0';i++){
+        EscribeLCD_c(a[i]);
+    }
+    FIN_CICLOS(MED_MENSAJE);
+}
+void DireccionaLCD(unsigned char a){
+    // a: dirección DDRAM con el bit 7 en 1 (0x80 primera línea, 0xC0 segunda).
+    EncolaLCD(a, 0);
+    if(a>=0x80 && a<=0x8F)
+        direccionLCD=a-0x80;
+    else if(a>=0xC0 && a<=0xCF)
+        direccionLCD=a-0xC0+16;
+    else
+        direccionLCD=SIN_CURSOR_FB;
+}
+void FijaCursorLCD(unsigned char fila,unsigned char columna){
+    // fila: 1 o 2, columna: 1 a 16
+    if(fila==1)
+        DireccionaLCD(0x80+columna-1);
+    else
+        DireccionaLCD(0xC0+columna-1);
+}
+void DesplazaPantallaD(void){
+    EncolaLCD(28, 0);
+}
+void DesplazaPantallaI(void){
+    EncolaLCD(24, 0);
+}
+void DesplazaCursorD(void){
+    EncolaLCD(20, 0);
+    direccionLCD=SIN_CURSOR_FB;
+}
+void DesplazaCursorI(void){
+    EncolaLCD(16, 0);
+    direccionLCD=SIN_CURSOR_FB;
+}
+void CrearCaracter(const unsigned char *arreglo,unsigned char posicionCGRAM){
+    if(glifosCGRAM[posicionCGRAM]==arreglo)
+        return;                                      // ya está cargado: no se envía nada
+    glifosCGRAM[posicionCGRAM]=arreglo;
+    EncolaLCD(0x40|(posicionCGRAM*8), 0);
+    for (int i=0;i<8;i++){
+        EncolaLCD(arreglo[i], LCD_RS);
+    }
+    DireccionaLCD(0x80);                             // vuelve a DDRAM, celda 0
+}
+void OcultarCursor(void){
+    ComandoLCD(0xC);
+}
+void MostrarCursor(void){
+    ComandoLCD(0xF);
+}
+
+// ------------------------------ Pantalla virtual ------------------------------
+
+void BorraFB(void){
+    // Deja la pantalla virtual en blanco (no envía nada al LCD).
+    for(unsigned char i=0;i<32;i++)
+        pantallaFB[i]=' ';
+    cursorFB=SIN_CURSOR_FB;
+}
+void EscribeFB_c(unsigned char pos, unsigned char a){
+    // pos: celda 0-31, a: carácter (0-7 son los de CGRAM)
+    pantallaFB[pos]=a;
+}
+void EscribeFB_n8(unsigned char pos, unsigned char a, unsigned char b){
+    // Igual que EscribeLCD_n8, pero a partir de la celda pos de la pantalla virtual.
+    INICIO_CICLOS(MED_ESCRIBE_N8);
+    if(b>=1 && b<=3)
+        EscribeFB_bcd(pos,BinarioABCD8(a),b);
+    FIN_CICLOS(MED_ESCRIBE_N8);
+}
+void EscribeFB_n16(unsigned char pos, unsigned int a, unsigned char b){
+    // Igual que EscribeLCD_n16 (1 a 5 cifras), en la pantalla virtual.
+    if(b>=1 && b<=5)
+        EscribeFB_bcd(pos,BinarioABCD16(a),b);
+}
+void EscribeFB_bcd(unsigned char pos, unsigned long bcd, unsigned char b){
+    // Escribe las b cifras menos significativas de un número en BCD empaquetado.
+    // Solo separa nibbles: el costo es fijo y pequeño, sin conversiones.
+    pos+=b;
+    while(b!=0){
+        b--;
+        pos--;
+        pantallaFB[pos]=((unsigned char)bcd & 0x0F)+48;
+        bcd>>=4;
+    }
+}
+void MensajeFB(unsigned char pos, char* a){
+    INICIO_CICLOS(MED_MENSAJE);
+    for (int i=0;a[i] != '\0' && pos<32;i++){
+        pantallaFB[pos++]=a[i];
+    }
+    FIN_CICLOS(MED_MENSAJE);
+}
+void DibujaPantalla(const ElementoPantalla *p){
+    // Borra la pantalla virtual y copia una tabla de pantalla. Solo toca pantallaFB:
+    // RefrescaLCD() manda luego las celdas que cambiaron respecto de la anterior.
+    INICIO_CICLOS(MED_MENSAJE);
+    BorraFB();
+    for( ;p->celda != FIN_PANTALLA;p++){
+        unsigned char pos=p->celda;
+        if(p->texto != 0){
+            for(const char *t=p->texto;*t != '\0' && pos<32;t++)
+                pantallaFB[pos++]=*t;
+        }else{
+            for(unsigned char i=0;i<p->veces && pos<32;i++)
+                pantallaFB[pos++]=p->glifo;
+        }
+    }
+    FIN_CICLOS(MED_MENSAJE);
+}
+void FijaCursorFB(unsigned char pos){
+    // pos: celda donde debe quedar el cursor (para MostrarCursor), o SIN_CURSOR_FB.
+    cursorFB=pos;
+}
+void RefrescaLCD(void){
+    // Envía al LCD solo las celdas que cambiaron. Si la celda siguiente a la
+    // última escrita también cambió, no hace falta otro comando de dirección.
+    INICIO_CICLOS(MED_REFRESCA);
+    bytesRefrescoLCD=0;
+    for(unsigned char i=0;i<32;i++){
+        if(pantallaFB[i] != pantallaLCD[i]){
+            if(direccionLCD != i){
+                DireccionaLCD(i<16 ? 0x80+i : 0xC0+i-16);
+                bytesRefrescoLCD++;
+            }
+            EscribeLCD_c(pantallaFB[i]);
+            bytesRefrescoLCD++;
+        }
+    }
+    if(cursorFB != SIN_CURSOR_FB && direccionLCD != cursorFB){
+        DireccionaLCD(cursorFB<16 ? 0x80+cursorFB : 0xC0+cursorFB-16);
+        bytesRefrescoLCD++;
+    }
+    FIN_CICLOS(MED_REFRESCA);
+}
+
+#endif
@@ -0,0 +1,743 @@
+// ============================================================================
+// escenario.c - Corre Lab4.c con un escenario de estímulos y verificaciones
+// ============================================================================
+// Uso:  ./lab4_sim escenarios/arranque.esc [SEMILLA]
+//       (SEMILLA reemplaza la del comando "azar", para repetir un escenario con
+//       las interrupciones en otros puntos)
+//
+// El escenario es un archivo de texto con un comando por línea ('#' comenta).
+// Cada comando avanza el reloj del escenario lo que dura; con "fondo" delante
+// los estímulos arrancan en el tiempo actual sin avanzarlo (piezas mientras se
+// presionan teclas, por ejemplo).
+//
+//   espera MS                       avanza el reloj del escenario
+//   tecla NOMBRE [MS]               presiona MS (100) y suelta; luego 100 ms libres
+//   teclas DIGITOS                  una tecla por dígito ("teclas 120")
+//   tecla_rebote NOMBRE REBOTES     como tecla, con rebotes de 1 ms al presionar y soltar
+//   piezas N PERIODO [ANCHO]        N pulsos en RC1 (ms; ANCHO = PERIODO / 2)
+//   piezas_rebote N PERIODO REBOTES cada subida con REBOTES rebotes de 0.3 ms
+//   carril BIT N PERIODO            N pulsos en RC<BIT> (MULTICARRIL)
+//   parada                          flanco de bajada en RC2
+//   caida                           VDD bajo el umbral del HLVD
+//   eeprom DIRECCION BYTE...        EEPROM de datos al encender (antes de avanzar el reloj)
+//   azar SEMILLA JITTER             costo al azar por acceso (mueve las interrupciones)
+//   verifica VARIABLE OP VALOR      OP: == != < <= > >=
+//   verifica linea1 "texto"         texto visible del LCD (linea2 igual)
+//   verifica lcd_coherente          LCD del modelo == pantallaLCD == pantallaFB
+//   verifica salidas                7 segmentos y RGB == unidades7Seg y decenasRGB
+//   reporte                         imprime el resumen en ese momento
+//   marca                           desde aquí miden lcd_ms, lcd_bytes_marca e isr_us_ms
+//   imprime VARIABLE                muestra el valor, sin verificarlo
+//   ciclos ARCHIVO                  ciclosMax[MED_*] en ARCHIVO, en CSV (lab4_sim_ciclos)
+//   repite N ... fin_repite         repite N veces los comandos del bloque
+//
+// Nombres de tecla: 0-9, OK, EMERGENCIA, SUPR, REINICIO, FIN, LUZ.
+// VARIABLE es una global del firmware (ver VARIABLES, admite [índice]) o una
+// medición del simulador (ver MEDICIONES).
+//
+// Al final imprime el resumen y termina con 1 si falló alguna verificación.
+// ============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+
+void lab4_main(void);
+// main() del firmware (el Makefile lo compila con -Dmain=lab4_main).
+
+// ------------------------------ Globales del firmware ------------------------------
+
+// Tipos del PC equivalentes: unsigned int de XC8 = unsigned short (16 bits).
+#define VARIABLES(X)                                        \
+    X(piezasTotalesContadas,  unsigned short,          1)  \
+    X(piezasObjetivo,         unsigned short,          1)  \
+    X(piezasContadasTotal,    unsigned long,           1)  \
+    X(piezasExcedentes,       unsigned short,          1)  \
+    X(piezasPendientes,       volatile unsigned short, 1)  \
+    X(flancosRechazados,      volatile unsigned short, 1)  \
+    X(msBloqueados,           unsigned long,           1)  \
+    X(estadoUI,               unsigned char,           1)  \
+    X(estadoEnergia,          unsigned char,           1)  \
+    X(vecesDormido,           unsigned short,          1)  \
+    X(bytesLCD,               unsigned long,           1)  \
+    X(bytesFaltantes,         unsigned char,           1)  \
+    X(bytesMaxFaltantes,      unsigned char,           1)  \
+    X(eventosPerdidos,        volatile unsigned char,  1)  \
+    X(tramasPerdidas,         unsigned short,          1)  \
+    X(guardadosEEPROM,        unsigned short,          1)  \
+    X(bytesEEPROMPendientes,  volatile unsigned char,  1)  \
+    X(colaLCDEntrada,         volatile unsigned char,  1)  \
+    X(colaLCDSalida,          volatile unsigned char,  1)  \
+    X(esperasColaLCD,         unsigned short,          1)  \
+    X(segundosSistema,        unsigned long,           1)  \
+    X(divisorSegundo,         unsigned short,          1)  \
+    X(milisegundos,           volatile unsigned short, 1)  \
+    X(unidades7Seg,           unsigned short,          1)  \
+    X(decenasRGB,             unsigned short,          1)  \
+    X(vistaConteo,            unsigned char,           1)  \
+    X(recetaActiva,           unsigned char,           1)  \
+    X(recetaPedida,           unsigned char,           1)  \
+    X(indiceDigitoObjetivo,   unsigned char,           1)  \
+    X(loteActual,             unsigned char,           1)  \
+    X(lotesReceta,            unsigned char,           1)  \
+    X(perfilReloj,            unsigned char,           1)  \
+    X(flagConteoActivo,       unsigned char,           1)  \
+    X(segundosSinActividad,   unsigned char,           1)  \
+    X(latenciaParadaMax,      unsigned short,          1)  \
+    X(latenciaPiezaMax,       unsigned short,          2)  \
+    X(esperaTXMax,            unsigned short,          2)  \
+    X(esperaPerfilMax,        unsigned short,          2)  \
+    X(esperaIOFSMax,          unsigned short,          1)  \
+    X(msEsperaEmergencia,     unsigned short,          1)  \
+    X(msArranqueConteo,       unsigned short,          1)  \
+    X(ciclosMaxISR,           unsigned short,          1)  \
+    X(msDespertarTeclado,     unsigned short,          1)  \
+    X(porcentajeReposo,       unsigned char,           1)  \
+    X(piezasPorMinuto,        unsigned short,          1)  \
+    X(faltantesBCD,           unsigned long,           1)  \
+    X(pantallaFB,             unsigned char,           32) \
+    X(pantallaLCD,            unsigned char,           32) \
+    X(coloresDecena,          const unsigned char,     6)
+
+#ifdef MULTICARRIL
+#define VARIABLES_CARRILES(X)                               \
+    X(conteoCarril,           volatile unsigned short, 8)  \
+    X(lotesCarril,            volatile unsigned char,  8)  \
+    X(carrilMostrado,         unsigned char,           1)
+#else
+#define VARIABLES_CARRILES(X)
+#endif
+
+#ifdef MEDIR_CICLOS
+#define VARIABLES_CICLOS(X)                                 \
+    X(ciclosMax,              unsigned short,          10)
+#else
+#define VARIABLES_CICLOS(X)
+#endif
+
+#define EXTERN(nombre, tipo, total)    SIM_EXTERN_##total(nombre, tipo)
+#define SIM_EXTERN_1(nombre, tipo)     extern tipo nombre;
+#define SIM_EXTERN_2(nombre, tipo)     extern tipo nombre[2];
+#define SIM_EXTERN_6(nombre, tipo)     extern tipo nombre[6];
+#define SIM_EXTERN_8(nombre, tipo)     extern tipo nombre[8];
+#define SIM_EXTERN_10(nombre, tipo)    extern tipo nombre[10];
+#define SIM_EXTERN_32(nombre, tipo)    extern tipo nombre[32];
+// Las variables simples se declaran como variables y los arreglos como arreglos.
+
+VARIABLES(EXTERN)
+VARIABLES_CARRILES(EXTERN)
+VARIABLES_CICLOS(EXTERN)
+
+typedef struct{
+    const char *nombre;
+    const volatile void *direccion;
+    unsigned char tamano;
+    unsigned char total;
+} Variable;
+
+#define ENTRADA(nombre, tipo, total) \
+    {#nombre, (const volatile void *)&nombre, (unsigned char)(sizeof(tipo)), total},
+
+static const Variable variables[] = {
+    VARIABLES(ENTRADA)
+    VARIABLES_CARRILES(ENTRADA)
+    VARIABLES_CICLOS(ENTRADA)
+};
+
+// ------------------------------ Escenario ------------------------------
+
+#define VER_VALOR       0
+#define VER_LINEA       1
+#define VER_COHERENTE   2
+#define VER_SALIDAS     3
+#define VER_REPORTE     4
+#define VER_CICLOS      5
+#define VER_MARCA       6
+#define VER_IMPRIME     7
+
+typedef struct{
+    unsigned char tipo;
+    char variable[40];
+    char operador[3];
+    long long valor;
+    unsigned char fila;
+    char texto[17];
+    unsigned int linea;
+} Verificacion;
+
+static Estimulo *estimulos;
+static unsigned int totalEstimulos;
+static unsigned int capacidad;
+static Verificacion *verificaciones;
+static unsigned int totalVerificaciones;
+static unsigned int fallas;
+static uint64_t reloj;
+// Reloj del escenario (tiempo del próximo estímulo).
+static unsigned int jitterEscenario;
+static unsigned int semillaEscenario = 1;
+static uint64_t marca;
+static uint64_t marcaISR;
+static unsigned long marcaLCD;
+// Tiempo del último "marca" y sim.tiempoISR y sim.lcdBytes en ese momento.
+
+static void Agrega(uint64_t tiempo, unsigned char tipo, unsigned short arg){
+    if(totalEstimulos == capacidad){
+        capacidad = capacidad ? capacidad * 2 : 1024;
+        estimulos = realloc(estimulos, capacidad * sizeof(Estimulo));
+        if(estimulos == 0){
+            fprintf(stderr, "sin memoria\n");
+            exit(2);
+        }
+    }
+    estimulos[totalEstimulos].tiempo = tiempo;
+    estimulos[totalEstimulos].tipo   = tipo;
+    estimulos[totalEstimulos].arg    = arg;
+    totalEstimulos++;
+}
+
+static int OrdenEstimulos(const void *a, const void *b){
+    // Por tiempo; a igual tiempo, en el orden del escenario (el arg no importa aquí,
+    // la posición original se guarda en el orden estable de Ordena()).
+    const Estimulo *x = a;
+    const Estimulo *y = b;
+    if(x->tiempo != y->tiempo) return x->tiempo < y->tiempo ? -1 : 1;
+    return 0;
+}
+
+static void Ordena(void){
+    // Inserción por bloques: los comandos casi siempre llegan en orden, así que es
+    // lineal; "fondo" desordena solo un tramo.
+    unsigned int i;
+    int ordenado = 1;
+
+    for(i = 1; i < totalEstimulos; i++){
+        if(estimulos[i].tiempo < estimulos[i - 1].tiempo){
+            ordenado = 0;
+            break;
+        }
+    }
+    if(ordenado){
+        return;
+    }
+    for(i = 1; i < totalEstimulos; i++){
+        Estimulo e = estimulos[i];
+        unsigned int j = i;
+        while(j > 0 && OrdenEstimulos(&estimulos[j - 1], &e) > 0){
+            estimulos[j] = estimulos[j - 1];
+            j--;
+        }
+        estimulos[j] = e;
+    }
+}
+
+static int BitTecla(const char *nombre){
+    static const char *const nombres[16] = {
+        "1", "2", "3", "OK",
+        "4", "5", "6", "EMERGENCIA",
+        "7", "8", "9", "SUPR",
+        "REINICIO", "0", "FIN", "LUZ"
+    };
+    // Mismo orden que mapaTeclas[] en Lab4.c (bit = fila × 4 + columna).
+    for(int i = 0; i < 16; i++){
+        if(strcmp(nombre, nombres[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint64_t Tecla(uint64_t t, int bit, unsigned int ms, unsigned int rebotes){
+    unsigned int i;
+
+    for(i = 0; i < rebotes; i++){
+        Agrega(t + SIM_MS(i), EST_TECLA, (unsigned short)(bit | ((~i & 1) << 4)));
+    }
+    t += SIM_MS(rebotes);
+    Agrega(t, EST_TECLA, (unsigned short)(bit | 0x10));
+    t += SIM_MS(ms);
+    for(i = 0; i < rebotes; i++){
+        Agrega(t + SIM_MS(i), EST_TECLA, (unsigned short)(bit | ((i & 1) << 4)));
+    }
+    t += SIM_MS(rebotes);
+    Agrega(t, EST_TECLA, (unsigned short)bit);
+    return t + SIM_MS(100);
+}
+
+static uint64_t Piezas(uint64_t t, unsigned long n, double periodo, double ancho, unsigned int rebotes,
+                       unsigned char tipo, unsigned char bit){
+    // Sensor activo en bajo: baja al llegar la pieza y sube (captura) al irse.
+    for(unsigned long i = 0; i < n; i++){
+        uint64_t inicio = t + (uint64_t)(periodo * 2000.0 * i);
+        uint64_t subida = inicio + (uint64_t)(ancho * 2000.0);
+        if(tipo == EST_SENSOR){
+            Agrega(inicio, EST_SENSOR, 0);
+            Agrega(subida, EST_SENSOR, 3);
+            for(unsigned int r = 0; r < rebotes; r++){
+                Agrega(subida + SIM_US(300) * (2 * r + 1), EST_SENSOR, 0);
+                Agrega(subida + SIM_US(300) * (2 * r + 2), EST_SENSOR, 1);
+            }
+        }else{
+            Agrega(inicio, EST_CARRIL, bit);
+            Agrega(subida, EST_CARRIL, (unsigned short)(bit | 0x08));
+        }
+    }
+    return t + (uint64_t)(periodo * 2000.0 * n);
+}
+
+static void Error(const char *archivo, unsigned int linea, const char *texto){
+    fprintf(stderr, "%s:%u: %s\n", archivo, linea, texto);
+    exit(2);
+}
+
+static void Carga(const char *archivo){
+    FILE *f = fopen(archivo, "r");
+    char texto[256];
+    unsigned int linea = 0;
+    long inicioRepite = 0;
+    unsigned int lineaRepite = 0;
+    unsigned long vueltasRepite = 0;
+    // Un solo nivel de "repite": posición y línea donde empieza el bloque.
+
+    if(f == 0){
+        perror(archivo);
+        exit(2);
+    }
+    while(fgets(texto, sizeof texto, f) != 0){
+        char comando[32] = "";
+        char a[64] = "";
+        char b[64] = "";
+        char c[64] = "";
+        char *p = strchr(texto, '#');
+        int fondo = 0;
+        uint64_t t = reloj;
+        uint64_t fin = reloj;
+        int campos;
+
+        linea++;
+        if(p != 0 && strchr(texto, '"') == 0) *p = '\0';
+        campos = sscanf(texto, "%31s %63s %63s %63s", comando, a, b, c);
+        if(campos <= 0){
+            continue;
+        }
+        if(strcmp(comando, "fondo") == 0){
+            fondo  = 1;
+            campos = sscanf(texto, "%*s %31s %63s %63s %63s", comando, a, b, c);
+        }
+
+        if(strcmp(comando, "repite") == 0){
+            if(vueltasRepite != 0) Error(archivo, linea, "repite anidado");
+            vueltasRepite = strtoul(a, 0, 10);
+            if(vueltasRepite == 0) Error(archivo, linea, "repite 0");
+            inicioRepite  = ftell(f);
+            lineaRepite   = linea;
+            continue;
+        }else if(strcmp(comando, "fin_repite") == 0){
+            if(vueltasRepite == 0) Error(archivo, linea, "fin_repite sin repite");
+            if(--vueltasRepite != 0){
+                fseek(f, inicioRepite, SEEK_SET);
+                linea = lineaRepite;
+            }
+            continue;
+        }else if(strcmp(comando, "espera") == 0){
+            fin = t + SIM_MS(strtoull(a, 0, 10));
+        }else if(strcmp(comando, "tecla") == 0 || strcmp(comando, "tecla_rebote") == 0){
+            int bit = BitTecla(a);
+            unsigned int ms = 100;
+            unsigned int rebotes = 0;
+            if(bit < 0) Error(archivo, linea, "tecla desconocida");
+            if(comando[5] == '_') rebotes = (unsigned int)atoi(b);
+            else if(campos > 2)   ms      = (unsigned int)atoi(b);
+            fin = Tecla(t, bit, ms, rebotes);
+        }else if(strcmp(comando, "teclas") == 0){
+            fin = t;
+            for(const char *d = a; *d != '\0'; d++){
+                char nombre[2] = {*d, '\0'};
+                int bit = BitTecla(nombre);
+                if(bit < 0) Error(archivo, linea, "dígito inválido");
+                fin = Tecla(fin, bit, 100, 0);
+            }
+        }else if(strcmp(comando, "piezas") == 0 || strcmp(comando, "piezas_rebote") == 0){
+            double periodo = atof(b);
+            double ancho = periodo / 2;
+            unsigned int rebotes = 0;
+            if(comando[6] == '_')   rebotes = (unsigned int)atoi(c);
+            else if(campos > 3)     ancho   = atof(c);
+            fin = Piezas(t, strtoul(a, 0, 10), periodo, ancho, rebotes, EST_SENSOR, 0);
+        }else if(strcmp(comando, "carril") == 0){
+            double periodo = atof(c);
+            fin = Piezas(t, strtoul(b, 0, 10), periodo, periodo / 2, 0, EST_CARRIL, (unsigned char)atoi(a));
+        }else if(strcmp(comando, "parada") == 0){
+            Agrega(t, EST_PARADA, 0);
+            fin = t + SIM_MS(1);
+        }else if(strcmp(comando, "caida") == 0){
+            Agrega(t, EST_CAIDA, 0);
+        }else if(strcmp(comando, "eeprom") == 0){
+            char *resto;
+            unsigned long direccion = strtoul(a, &resto, 0);
+            if(reloj != 0) Error(archivo, linea, "eeprom va antes de avanzar el reloj");
+            resto = strstr(texto, a) + strlen(a);
+            // Los bytes van en hexadecimal, tantos como tenga la línea.
+            for(;;){
+                char *fin;
+                unsigned long dato = strtoul(resto, &fin, 16);
+                if(fin == resto) break;
+                if(direccion > 255 || dato > 255) Error(archivo, linea, "eeprom fuera de rango");
+                simEEPROM[direccion++] = (unsigned char)dato;
+                resto = fin;
+            }
+        }else if(strcmp(comando, "azar") == 0){
+            semillaEscenario = (unsigned int)strtoul(a, 0, 10);
+            jitterEscenario  = (unsigned int)strtoul(b, 0, 10);
+        }else if(strcmp(comando, "verifica") == 0 || strcmp(comando, "reporte") == 0 ||
+                 strcmp(comando, "ciclos") == 0 || strcmp(comando, "marca") == 0 ||
+                 strcmp(comando, "imprime") == 0){
+            Verificacion v;
+            memset(&v, 0, sizeof v);
+            v.linea = linea;
+            if(comando[0] == 'r'){
+                v.tipo = VER_REPORTE;
+            }else if(comando[0] == 'm'){
+                v.tipo = VER_MARCA;
+            }else if(comando[0] == 'i'){
+                if(campos < 2) Error(archivo, linea, "imprime VARIABLE");
+                v.tipo = VER_IMPRIME;
+                snprintf(v.variable, sizeof v.variable, "%s", a);
+            }else if(comando[0] == 'c'){
+                if(campos < 2) Error(archivo, linea, "ciclos ARCHIVO");
+                v.tipo = VER_CICLOS;
+                snprintf(v.variable, sizeof v.variable, "%s", a);
+            }else if(strcmp(a, "linea1") == 0 || strcmp(a, "linea2") == 0){
+                char *inicio = strchr(texto, '"');
+                char *final  = inicio ? strchr(inicio + 1, '"') : 0;
+                if(final == 0 || final - inicio - 1 > 16) Error(archivo, linea, "texto inválido");
+                v.tipo = VER_LINEA;
+                v.fila = (unsigned char)(a[5] - '1');
+                memcpy(v.texto, inicio + 1, (size_t)(final - inicio - 1));
+            }else if(strcmp(a, "lcd_coherente") == 0){
+                v.tipo = VER_COHERENTE;
+            }else if(strcmp(a, "salidas") == 0){
+                v.tipo = VER_SALIDAS;
+            }else{
+                if(campos < 4) Error(archivo, linea, "verifica VARIABLE OP VALOR");
+                v.tipo = VER_VALOR;
+                snprintf(v.variable, sizeof v.variable, "%s", a);
+                snprintf(v.operador, sizeof v.operador, "%s", b);
+                v.valor = strtoll(c, 0, 0);
+            }
+            verificaciones = realloc(verificaciones, (totalVerificaciones + 1) * sizeof(Verificacion));
+            verificaciones[totalVerificaciones] = v;
+            Agrega(t, EST_VERIFICA, (unsigned short)totalVerificaciones);
+            totalVerificaciones++;
+        }else{
+            Error(archivo, linea, "comando desconocido");
+        }
+
+        if(!fondo){
+            reloj = fin;
+        }
+    }
+    fclose(f);
+    Agrega(reloj, EST_FIN, 0);
+    Ordena();
+}
+
+// ------------------------------ Mediciones ------------------------------
+
+static long long Perdidas(void){
+    // Piezas que pasaron y no están contadas, ni como excedentes ni por contar.
+    return (long long)sim.flancosPieza - (long long)piezasContadasTotal
+         - (long long)piezasExcedentes - (long long)piezasPendientes;
+}
+
+static long long Deriva(void){
+    // Reloj del firmware (segundos y ms del segundo en curso) menos el simulado, en ms.
+    return (long long)segundosSistema * 1000 + divisorSegundo - (long long)(sim.ahora / SIM_MS(1));
+}
+
+static long long LcdMs(void){
+    // Desde "marca" hasta el último byte que recibió el LCD, en ms redondeados hacia
+    // arriba (0 si no llegó ninguno después de la marca).
+    if(sim.lcdUltimo <= marca){
+        return 0;
+    }
+    return (long long)((sim.lcdUltimo - marca + SIM_MS(1) - 1) / SIM_MS(1));
+}
+
+static long long IsrUsPorMs(void){
+    // Tiempo en la ISR por milisegundo (una muestra de PORTC y del teclado) desde
+    // "marca", en us.
+    uint64_t ms = (sim.ahora - marca) / SIM_MS(1);
+    if(ms == 0){
+        return 0;
+    }
+    return (long long)((sim.tiempoISR - marcaISR) / SIM_US(1) / ms);
+}
+
+static int Medicion(const char *nombre, long long *valor){
+    if(strcmp(nombre, "inyectadas") == 0)         *valor = (long long)sim.flancosPieza;
+    else if(strcmp(nombre, "perdidas") == 0)      *valor = Perdidas();
+    else if(strcmp(nombre, "flancos") == 0)       *valor = (long long)sim.flancosRC1;
+    else if(strcmp(nombre, "piezas_dormido") == 0)*valor = (long long)sim.piezasDormido;
+    else if(strcmp(nombre, "ms") == 0)            *valor = (long long)(sim.ahora / SIM_MS(1));
+    else if(strcmp(nombre, "deriva_ms") == 0)     *valor = Deriva();
+    else if(strcmp(nombre, "isr_ms") == 0)        *valor = (long long)(sim.tiempoISR / SIM_MS(1));
+    else if(strcmp(nombre, "isr_us_ms") == 0)     *valor = IsrUsPorMs();
+    else if(strcmp(nombre, "isr_max_ciclos") == 0)*valor = (long long)sim.isrMaxCiclos;
+    else if(strcmp(nombre, "reposo_ms") == 0)     *valor = (long long)(sim.tiempoReposo / SIM_MS(1));
+    else if(strcmp(nombre, "dormido_ms") == 0)    *valor = (long long)(sim.tiempoDormido / SIM_MS(1));
+    else if(strcmp(nombre, "espera_ms") == 0)     *valor = (long long)(sim.tiempoEspera / SIM_MS(1));
+    else if(strcmp(nombre, "dormidas") == 0)      *valor = (long long)sim.vecesDormido;
+    else if(strcmp(nombre, "lcd_bytes") == 0)     *valor = (long long)sim.lcdBytes;
+    else if(strcmp(nombre, "lcd_errores") == 0)   *valor = (long long)sim.lcdErrores;
+    else if(strcmp(nombre, "lcd_ms") == 0)        *valor = LcdMs();
+    else if(strcmp(nombre, "lcd_bytes_marca") == 0) *valor = (long long)(sim.lcdBytes - marcaLCD);
+    else if(strcmp(nombre, "tx_bytes") == 0)      *valor = (long long)sim.bytesTX;
+    else if(strcmp(nombre, "tramas_malas") == 0)  *valor = (long long)sim.tramasMalas;
+    else if(strcmp(nombre, "eeprom_escrituras") == 0) *valor = (long long)sim.escriturasEEPROM;
+    else if(strcmp(nombre, "eeprom_max_celda") == 0)  *valor = (long long)sim.maxEscriturasCelda;
+    else if(strcmp(nombre, "isr_baja") == 0)      *valor = (long long)sim.isrBaja;
+    else if(strcmp(nombre, "isr_alta") == 0)      *valor = (long long)sim.isrAlta;
+    else if(strcmp(nombre, "rgb") == 0)           *valor = (long long)(sim_puerto('E') & 0x07);
+    else if(strcmp(nombre, "cola_lcd") == 0)      *valor = (long long)((colaLCDEntrada - colaLCDSalida) & 0x7F);
+    else if(strncmp(nombre, "trama", 5) == 0 && nombre[5] >= '0' && nombre[5] <= '9'){
+        *valor = (long long)sim.tramas[atoi(nombre + 5) & 0x0F];
+    }else{
+        return 0;
+    }
+    return 1;
+}
+// Nombres para "verifica": trama1 a trama8 son las tramas válidas de cada TRAMA_*,
+// rgb es RE0-RE2 tal como salen del puerto y cola_lcd las entradas de la cola del LCD
+// que AtiendeLCD() todavía no mandó.
+
+static int LeeVariable(const char *texto, long long *valor){
+    char nombre[40];
+    unsigned int indice = 0;
+    const char *corchete = strchr(texto, '[');
+    size_t largo = corchete ? (size_t)(corchete - texto) : strlen(texto);
+
+    if(largo >= sizeof nombre){
+        return 0;
+    }
+    memcpy(nombre, texto, largo);
+    nombre[largo] = '\0';
+    if(corchete != 0){
+        indice = (unsigned int)strtoul(corchete + 1, 0, 0);
+    }
+    if(Medicion(nombre, valor)){
+        return 1;
+    }
+    for(unsigned int i = 0; i < sizeof variables / sizeof variables[0]; i++){
+        const Variable *v = &variables[i];
+        const volatile unsigned char *p;
+        if(strcmp(v->nombre, nombre) != 0 || indice >= v->total){
+            continue;
+        }
+        p = (const volatile unsigned char *)v->direccion + indice * v->tamano;
+        switch(v->tamano){
+            case 1:  *valor = *p; break;
+            case 2:  *valor = *(const volatile unsigned short *)p; break;
+            default: *valor = (long long)*(const volatile unsigned long *)p; break;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// ------------------------------ Reporte ------------------------------
+
+static void Reporte(FILE *salida){
+    static const char *const nombresTrama[9] = {
+        "?", "pieza", "inicio", "cumplido", "tecla", "energia", "emergencia", "perdidas", "traza"
+    };
+    double total = (double)(sim.ahora ? sim.ahora : 1);
+    char l1[17];
+    char l2[17];
+
+    sim_texto_lcd(0, l1);
+    sim_texto_lcd(1, l2);
+    fprintf(salida, "tiempo simulado      %.3f s (%llu ciclos)\n",
+            (double)sim.ahora / SIM_MS(1000), (unsigned long long)sim.ciclos);
+    fprintf(salida, "piezas inyectadas    %lu (flancos RC1 %lu, con el reloj detenido %lu)\n",
+            sim.flancosPieza, sim.flancosRC1, sim.piezasDormido);
+    fprintf(salida, "piezas contadas      %lu (excedentes %u, por contar %u, rechazadas %u)\n",
+            piezasContadasTotal, piezasExcedentes, piezasPendientes, flancosRechazados);
+    fprintf(salida, "piezas perdidas      %lld\n", Perdidas());
+    fprintf(salida, "tiempo bloqueado     %lu ms (msBloqueados), esperas activas %.1f ms\n",
+            msBloqueados, (double)sim.tiempoEspera / SIM_MS(1));
+    fprintf(salida, "uso del tiempo       ISR %.2f %%, reposo %.2f %%, dormido %.2f %%\n",
+            100.0 * sim.tiempoISR / total, 100.0 * sim.tiempoReposo / total,
+            100.0 * sim.tiempoDormido / total);
+    fprintf(salida, "interrupciones       baja %lu, alta %lu, la más larga %llu ciclos; Sleep %lu\n",
+            sim.isrBaja, sim.isrAlta, (unsigned long long)sim.isrMaxCiclos, sim.vecesDormido);
+    fprintf(salida, "LCD                  %lu bytes, %lu con el LCD ocupado\n",
+            sim.lcdBytes, sim.lcdErrores);
+    fprintf(salida, "LCD visible          [%s] [%s]\n", l1, l2);
+    fprintf(salida, "telemetria           %lu bytes, %lu tramas malas:", sim.bytesTX, sim.tramasMalas);
+    for(unsigned int i = 1; i < 9; i++){
+        if(sim.tramas[i] != 0){
+            fprintf(salida, " %s %lu", nombresTrama[i], sim.tramas[i]);
+        }
+    }
+    fprintf(salida, "\n");
+    fprintf(salida, "EEPROM               %lu bytes escritos, %lu en la celda más usada\n",
+            sim.escriturasEEPROM, sim.maxEscriturasCelda);
+    fprintf(salida, "reloj del firmware   %lu s, %u ms (simulado %llu s, deriva %lld ms)\n",
+            segundosSistema, milisegundos, (unsigned long long)(sim.ahora / SIM_MS(1000)), Deriva());
+}
+
+// ------------------------------ Verificaciones ------------------------------
+
+static void Falla(const Verificacion *v, const char *texto){
+    fprintf(stderr, "línea %u (%.3f s): FALLA %s\n", v->linea, (double)sim.ahora / SIM_MS(1000), texto);
+    fallas++;
+}
+
+static void EscribeCiclos(const Verificacion *v){
+#ifdef MEDIR_CICLOS
+    static const char *const nombres[10] = {
+        "isr", "envia_dato", "escribe_n8", "mensaje", "refresca",
+        "config_pregunta", "ciclo_principal", "suma_piezas", "retardo", "carriles"
+    };
+    // Mismo orden que los índices MED_* de Lab4.c.
+    FILE *f = fopen(v->variable, "w");
+
+    if(f == 0){
+        Falla(v, "no se pudo crear el archivo de ciclos");
+        return;
+    }
+    fprintf(f, "medicion,valor\n");
+    for(unsigned int i = 0; i < 10; i++){
+        fprintf(f, "ciclos_%s,%u\n", nombres[i], ciclosMax[i]);
+    }
+    fclose(f);
+#else
+    Falla(v, "ciclos necesita MEDIR_CICLOS (make banco)");
+#endif
+}
+
+static void Verifica(unsigned int indice){
+    const Verificacion *v = &verificaciones[indice];
+    char texto[160];
+
+    switch(v->tipo){
+        case VER_REPORTE:
+            printf("---- reporte (línea %u) ----\n", v->linea);
+            Reporte(stdout);
+            break;
+
+        case VER_VALOR:{
+            long long actual;
+            int bien;
+            if(!LeeVariable(v->variable, &actual)){
+                Falla(v, "variable desconocida");
+                break;
+            }
+            if(strcmp(v->operador, "==") == 0)      bien = actual == v->valor;
+            else if(strcmp(v->operador, "!=") == 0) bien = actual != v->valor;
+            else if(strcmp(v->operador, "<") == 0)  bien = actual <  v->valor;
+            else if(strcmp(v->operador, "<=") == 0) bien = actual <= v->valor;
+            else if(strcmp(v->operador, ">") == 0)  bien = actual >  v->valor;
+            else if(strcmp(v->operador, ">=") == 0) bien = actual >= v->valor;
+            else{
+                Falla(v, "operador desconocido");
+                break;
+            }
+            if(!bien){
+                snprintf(texto, sizeof texto, "%s = %lld, se esperaba %s %lld",
+                         v->variable, actual, v->operador, v->valor);
+                Falla(v, texto);
+            }
+            break;
+        }
+
+        case VER_LINEA:{
+            char visible[17];
+            char esperado[17];
+            sim_texto_lcd(v->fila, visible);
+            snprintf(esperado, sizeof esperado, "%-16s", v->texto);
+            if(strcmp(visible, esperado) != 0){
+                snprintf(texto, sizeof texto, "linea%u = \"%s\", se esperaba \"%s\"",
+                         v->fila + 1, visible, esperado);
+                Falla(v, texto);
+            }
+            break;
+        }
+
+        case VER_COHERENTE:
+            for(unsigned char celda = 0; celda < 32; celda++){
+                unsigned char modelo = sim_ddram_visible(celda);
+                if(modelo != pantallaLCD[celda] || pantallaLCD[celda] != pantallaFB[celda]){
+                    snprintf(texto, sizeof texto, "celda %u: LCD 0x%02X, pantallaLCD 0x%02X, pantallaFB 0x%02X",
+                             celda, modelo, pantallaLCD[celda], pantallaFB[celda]);
+                    Falla(v, texto);
+                    break;
+                }
+            }
+            break;
+
+        case VER_SALIDAS:
+            if((sim_puerto('D') & 0x0F) != (unidades7Seg & 0x0F)){
+                snprintf(texto, sizeof texto, "RD0-RD3 = %u, unidades7Seg = %u",
+                         sim_puerto('D') & 0x0F, unidades7Seg);
+                Falla(v, texto);
+            }
+            if(decenasRGB < 6 && (sim_puerto('E') & 0x07) != coloresDecena[decenasRGB] &&
+               (sim_puerto('E') & 0x07) != 0x03){
+                snprintf(texto, sizeof texto, "RE0-RE2 = %u, coloresDecena[%u] = %u",
+                         sim_puerto('E') & 0x07, decenasRGB, coloresDecena[decenasRGB]);
+                Falla(v, texto);
+            }
+            // 0b011 (rojo) es la parada de emergencia, que ISRParada() escribe directo.
+            break;
+
+        case VER_CICLOS:
+            EscribeCiclos(v);
+            break;
+
+        case VER_MARCA:
+            marca    = sim.ahora;
+            marcaISR = sim.tiempoISR;
+            marcaLCD = sim.lcdBytes;
+            break;
+
+        case VER_IMPRIME:{
+            long long actual;
+            if(!LeeVariable(v->variable, &actual)){
+                Falla(v, "variable desconocida");
+                break;
+            }
+            printf("%s = %lld\n", v->variable, actual);
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv){
+    if(argc != 2 && argc != 3){
+        fprintf(stderr, "uso: %s escenario.esc [semilla]\n", argv[0]);
+        return 2;
+    }
+    Carga(argv[1]);
+    if(argc == 3){
+        semillaEscenario = (unsigned int)strtoul(argv[2], 0, 10);
+    }
+
+    sim_inicia(estimulos, totalEstimulos, jitterEscenario, semillaEscenario);
+    sim_corre(lab4_main, Verifica);
+
+    if(argc == 3){
+        printf("==== %s (semilla %s) ====\n", argv[1], argv[2]);
+    }else{
+        printf("==== %s ====\n", argv[1]);
+    }
+    Reporte(stdout);
+    if(fallas != 0){
+        printf("%u verificaciones fallaron\n", fallas);
+        return 1;
+    }
+    printf("%u verificaciones correctas\n", totalVerificaciones);
+    return 0;
+}
@@ -0,0 +1,918 @@
+// ============================================================================
+// sim.c - PIC18F4550 virtual (ver sim.h)
+// ============================================================================
+// Los timers no se incrementan ciclo a ciclo: su valor sale de los ciclos
+// transcurridos y solo sus desbordes son eventos. Entre dos eventos el reloj
+// avanza de un salto, así un turno de 8 h se simula en segundos.
+//
+// Dos relojes:
+//   sim.ahora   tiempo real (medios microsegundos): estímulos, EEPROM, LCD.
+//   sim.ciclos  ciclos de instrucción con el oscilador en marcha: Timer0-3 y
+//               la EUSART. En Sleep (IDLEN = 0) se detiene, como en el PIC.
+// ============================================================================
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "sim_registros.h"
+
+void ISR(void);
+void ISRParada(void) __attribute__((weak));
+// Vectores del firmware (con __interrupt() vacío son funciones comunes). Sin
+// ISRParada() el firmware tiene un solo vector, ISR(), en 0x0008.
+
+// ------------------------------ Registros ------------------------------
+
+#define SIM_SFR8(r)   volatile sim_sfr8 sim_##r;
+#define SIM_SFR16(r)  volatile unsigned short sim_##r;
+
+SIM_SFR8(ADCON1)   SIM_SFR8(BAUDCON)  SIM_SFR8(CCP1CON)  SIM_SFR8(CCP2CON)
+SIM_SFR8(EEADR)    SIM_SFR8(EECON1)   SIM_SFR8(EECON2)   SIM_SFR8(EEDATA)
+SIM_SFR8(HLVDCON)  SIM_SFR8(INTCON)   SIM_SFR8(INTCON2)  SIM_SFR8(IPR1)
+SIM_SFR8(IPR2)     SIM_SFR8(LATA)     SIM_SFR8(LATB)     SIM_SFR8(LATD)
+SIM_SFR8(LATE)     SIM_SFR8(OSCCON)   SIM_SFR8(PIE1)     SIM_SFR8(PIE2)
+SIM_SFR8(PIR1)     SIM_SFR8(PIR2)     SIM_SFR8(PORTB)    SIM_SFR8(PORTC)
+SIM_SFR8(PR2)      SIM_SFR8(RCON)     SIM_SFR8(RCSTA)    SIM_SFR8(SPBRG)
+SIM_SFR8(SPBRGH)   SIM_SFR8(T0CON)    SIM_SFR8(T1CON)    SIM_SFR8(T2CON)
+SIM_SFR8(T3CON)    SIM_SFR8(TRISA)    SIM_SFR8(TRISB)    SIM_SFR8(TRISC)
+SIM_SFR8(TRISD)    SIM_SFR8(TRISE)    SIM_SFR8(TXREG)    SIM_SFR8(TXSTA)
+SIM_SFR16(CCPR1)   SIM_SFR16(CCPR2)   SIM_SFR16(TMR0)    SIM_SFR16(TMR1)
+SIM_SFR16(TMR3)
+
+// Bits que usa el modelo (misma posición que en xc.h)
+#define B_GIEH      0x80
+#define B_GIEL      0x40
+#define B_TMR0IE    0x20
+#define B_RBIE      0x08
+#define B_TMR0IF    0x04
+#define B_RBIF      0x01
+#define B_TMR0IP    0x04
+#define B_RBIP      0x01
+#define B_TMR0ON    0x80
+#define B_T08BIT    0x40
+#define B_T0CS      0x20
+#define B_PSA       0x08
+#define B_IPEN      0x80
+#define B_TXIF      0x10
+#define B_TRMT      0x02
+#define B_TXEN      0x20
+#define B_BRGH      0x04
+#define B_SPEN      0x80
+#define B_BRG16     0x08
+#define B_CCP1IF    0x04
+#define B_TMR2IF    0x02
+#define B_EEIF      0x10
+#define B_HLVDIF    0x04
+#define B_TMR3IF    0x02
+#define B_CCP2IF    0x01
+#define B_HLVDEN    0x10
+#define B_IRVST     0x20
+#define B_WR        0x02
+#define B_RD        0x01
+#define B_IDLEN     0x80
+
+Estadisticas sim;
+unsigned char simEEPROM[256];
+unsigned long simEscriturasCelda[256];
+
+#define NUNCA       UINT64_MAX
+
+// ------------------------------ Estado del modelo ------------------------------
+
+static const Estimulo *linea;
+static unsigned int totalEstimulos;
+static unsigned int proximoEstimulo;
+static void (*verificacion)(unsigned int);
+static jmp_buf salida;
+
+static unsigned int jitter;
+static uint32_t azar = 1;
+
+static unsigned int unidadesCiclo = 8;
+// Medios microsegundos por ciclo de instrucción (8 a 1 MHz, 1 a 8 MHz).
+static uint64_t proximoCiclo;
+// Ciclo del próximo evento (cualquiera de los dos relojes), para el camino rápido.
+
+static unsigned char nivelISR;
+// 0 = main(), 1 = vector bajo (0x0018), 2 = vector alto (0x0008).
+static unsigned char dormido;
+// 1 durante Sleep con IDLEN = 0: los relojes están detenidos.
+
+#define CAT_CPU     0
+#define CAT_ESPERA  1
+#define CAT_REPOSO  2
+static unsigned char categoria;
+// A qué se le carga el tiempo que pasa fuera de las ISR.
+static unsigned long accesosMain;
+static unsigned long accesosUltimaVuelta;
+
+// Escrituras pendientes: el acceso devuelve el registro y el firmware escribe
+// después, así que el efecto se aplica al comienzo del acceso siguiente.
+#define PEND_T2CON   0x01
+#define PEND_T3CON   0x02
+#define PEND_T1CON   0x04
+#define PEND_TXREG   0x08
+#define PEND_PORTB   0x10
+#define PEND_T0CON   0x20
+#define PEND_TMR0    0x40
+static unsigned char pendientes;
+
+// Timer2: solo importan sus banderas
+static uint64_t t2Anterior;
+// Ciclo del último desborde (o del último cambio de T2CON).
+static uint64_t t2Proximo;
+static unsigned int t2Pre = 1;
+static unsigned int t2Post = 1;
+static unsigned int t2Desbordes;
+// Desbordes desde la última bandera (postscaler).
+static unsigned char t2Valor;
+// TMR2 al detenerse o al cambiar T2CON.
+
+// Timer0, Timer3 y Timer1: valor = base + (ciclos - referencia) / prescaler
+static uint64_t t0Referencia;
+static unsigned int t0Base;
+static unsigned int t0Pre = 1;
+static unsigned int t0Modulo = 65536;
+static unsigned char t0Cuenta;
+// 1 = TMR0ON con el reloj de instrucción (T0CS = 0); con T0CS = 1 no hay pulsos en T0CKI.
+static uint64_t t0Proximo;
+static uint64_t t3Referencia;
+static unsigned int t3Base;
+static unsigned int t3Pre = 1;
+static uint64_t t3Proximo;
+static uint64_t t1Referencia;
+static unsigned int t1Base;
+static unsigned int t1Pre = 1;
+
+// EUSART
+static uint64_t txFin;
+// Ciclo en que el registro de desplazamiento termina su byte.
+static unsigned char txDesplazando;
+static unsigned char txByte;
+static unsigned char txEspera;
+// 1 = TXREG tiene un byte esperando al registro de desplazamiento.
+static unsigned char trama[7];
+static unsigned char bytesTrama;
+
+// EEPROM
+static uint64_t eeFin;
+static unsigned char eeDireccion;
+static unsigned char eeDato;
+
+// Pines de entrada
+static unsigned char pinesC = 0xFF;
+// Sensores activos en bajo con pull-up: en reposo todos en 1.
+static unsigned int teclas;
+// Bit en 1 = tecla presionada (bit = fila × 4 + columna, como mapaTeclas[]).
+static unsigned char columnasLeidas = 0xF0;
+// RB7-RB4 en la última lectura de PORTB (para la condición de cambio de RBIF).
+
+// HD44780
+static unsigned char ddram[0x80];
+static unsigned char cgram[64];
+static unsigned char lcdDireccion;
+static unsigned char lcdEnCGRAM;
+static signed char lcdIncremento = 1;
+static unsigned char lcdDesplazamiento;
+static unsigned char lcd4Bits;
+static unsigned char lcdMitad;
+static unsigned char lcdNibbleAlto;
+static uint64_t lcdOcupado;
+
+// ------------------------------ Utilidades ------------------------------
+
+static uint32_t Azar(void){
+    azar ^= azar << 13;
+    azar ^= azar >> 17;
+    azar ^= azar << 5;
+    return azar;
+}
+
+static uint64_t Min(uint64_t a, uint64_t b){
+    return a < b ? a : b;
+}
+
+static unsigned int ValorTimer0(void){
+    if(t0Cuenta == 0){
+        return t0Base;
+    }
+    return (unsigned int)((t0Base + (sim.ciclos - t0Referencia) / t0Pre) % t0Modulo);
+}
+
+static unsigned int ValorTimer3(void){
+    if((sim_T3CON.byte & 0x01) == 0){
+        return t3Base;
+    }
+    return (unsigned int)((t3Base + (sim.ciclos - t3Referencia) / t3Pre) & 0xFFFF);
+}
+
+static unsigned int ValorTimer1(void){
+    if((sim_T1CON.byte & 0x01) == 0){
+        return t1Base;
+    }
+    return (unsigned int)((t1Base + (sim.ciclos - t1Referencia) / t1Pre) & 0xFFFF);
+}
+
+static uint64_t CiclosByteTX(void){
+    // 10 bits (inicio, 8 datos, parada) según BRG16/BRGH.
+    unsigned int n = ((unsigned int)sim_SPBRGH.byte << 8) | sim_SPBRG.byte;
+    unsigned int divisor = 16;
+
+    if((sim_BAUDCON.byte & B_BRG16) && (sim_TXSTA.byte & B_BRGH)){
+        divisor = 1;
+    }else if((sim_BAUDCON.byte & B_BRG16) || (sim_TXSTA.byte & B_BRGH)){
+        divisor = 4;
+    }
+    return 10ULL * divisor * (n + 1);
+}
+
+static void CalculaProximo(void){
+    // Ciclo del próximo evento de cualquiera de los dos relojes.
+    uint64_t tiempo = NUNCA;
+
+    proximoCiclo = Min(Min(Min(t0Proximo, t2Proximo), t3Proximo), txDesplazando ? txFin : NUNCA);
+
+    if(proximoEstimulo < totalEstimulos){
+        tiempo = linea[proximoEstimulo].tiempo;
+    }
+    if(sim_EECON1.byte & B_WR){
+        tiempo = Min(tiempo, eeFin);
+    }
+    if(tiempo != NUNCA){
+        uint64_t faltan = tiempo > sim.ahora ? tiempo - sim.ahora : 0;
+        proximoCiclo = Min(proximoCiclo, sim.ciclos + (faltan + unidadesCiclo - 1) / unidadesCiclo);
+    }
+}
+
+// ------------------------------ Periféricos ------------------------------
+
+static void ProgramaTimer2(void){
+    // Escribir T2CON borra el prescaler y el postscaler; TMR2 conserva su cuenta.
+    unsigned char t2con = sim_T2CON.byte;
+    unsigned int periodo = (unsigned int)sim_PR2.byte + 1;
+
+    if(t2Proximo != NUNCA){
+        t2Valor = (unsigned char)((sim.ciclos - t2Anterior) / t2Pre);
+    }
+    t2Pre       = (t2con & 0x02) ? 16 : (t2con & 0x01) ? 4 : 1;
+    t2Post      = ((t2con >> 3) & 0x0F) + 1;
+    t2Desbordes = 0;
+
+    if(t2con & 0x04){
+        if(t2Valor >= periodo){
+            t2Valor = 0;
+        }
+        t2Anterior = sim.ciclos - (uint64_t)t2Valor * t2Pre;
+        t2Proximo  = sim.ciclos + (uint64_t)(periodo - t2Valor) * t2Pre;
+    }else{
+        t2Proximo  = NUNCA;
+    }
+}
+
+static void ProgramaTimer0(unsigned char escrituraTMR0){
+    // La cuenta sigue con la configuración anterior hasta el cambio; escribir TMR0
+    // (o T0CON) borra el prescaler, como en el PIC.
+    unsigned char t0con = sim_T0CON.byte;
+
+    t0Base = escrituraTMR0 ? sim_TMR0 : ValorTimer0();
+    t0Pre        = (t0con & B_PSA) ? 1 : 2u << (t0con & 0x07);
+    t0Modulo     = (t0con & B_T08BIT) ? 256 : 65536;
+    t0Base      %= t0Modulo;
+    t0Cuenta     = (t0con & B_TMR0ON) && (t0con & B_T0CS) == 0;
+    t0Referencia = sim.ciclos;
+    t0Proximo    = t0Cuenta ? sim.ciclos + (uint64_t)(t0Modulo - t0Base) * t0Pre : NUNCA;
+}
+
+static void ProgramaTimer3(void){
+    t3Base       = ValorTimer3();
+    t3Pre        = 1u << ((sim_T3CON.byte >> 4) & 0x03);
+    t3Referencia = sim.ciclos;
+    t3Proximo    = (sim_T3CON.byte & 0x01) ? sim.ciclos + (uint64_t)(65536 - t3Base) * t3Pre : NUNCA;
+}
+
+static void ProgramaTimer1(void){
+    t1Base       = ValorTimer1();
+    t1Pre        = 1u << ((sim_T1CON.byte >> 4) & 0x03);
+    t1Referencia = sim.ciclos;
+}
+
+static unsigned char Columnas(void){
+    // RB7-RB4 con pull-up: una tecla presionada baja su columna si su fila es salida en 0.
+    unsigned char columnas = 0xF0;
+
+    for(unsigned int bit = 0; bit < 16; bit++){
+        unsigned int fila = bit >> 2;
+        if((teclas & (1u << bit)) && (sim_TRISB.byte & (1u << fila)) == 0 &&
+           (sim_LATB.byte & (1u << fila)) == 0){
+            columnas &= (unsigned char)~(0x10 << (bit & 3));
+        }
+    }
+    return columnas;
+}
+
+static void RevisaCambioPORTB(void){
+    if(Columnas() != columnasLeidas){
+        sim_INTCON.byte |= B_RBIF;
+    }
+}
+
+static void DecodificaTX(unsigned char dato){
+    // Cuenta las tramas de telemetría por tipo (mismo formato que DecodificaTelemetria).
+    unsigned char crc = 0;
+
+    sim.bytesTX++;
+    if(bytesTrama == 0 && dato != 0xA5){
+        sim.tramasMalas++;
+        return;
+    }
+    trama[bytesTrama++] = dato;
+    if(bytesTrama < 7){
+        return;
+    }
+    bytesTrama = 0;
+    for(unsigned int i = 1; i < 6; i++){
+        crc ^= trama[i];
+        for(unsigned int j = 0; j < 8; j++){
+            crc = (crc & 0x80) ? (unsigned char)((crc << 1) ^ 0x07) : (unsigned char)(crc << 1);
+        }
+    }
+    if(crc != trama[6]){
+        sim.tramasMalas++;
+        return;
+    }
+    sim.tramas[trama[1] & 0x0F]++;
+}
+
+static void CargaTSR(unsigned char dato){
+    txByte        = dato;
+    txDesplazando = 1;
+    txFin         = sim.ciclos + CiclosByteTX();
+    sim_TXSTA.byte &= (unsigned char)~B_TRMT;
+    sim_PIR1.byte  |= B_TXIF;
+}
+
+static void EscrituraTXREG(void){
+    if((sim_TXSTA.byte & B_TXEN) == 0 || (sim_RCSTA.byte & B_SPEN) == 0){
+        return;
+    }
+    if(txDesplazando == 0){
+        CargaTSR(sim_TXREG.byte);
+    }else{
+        txEspera = 1;
+        sim_PIR1.byte &= (unsigned char)~B_TXIF;
+    }
+}
+
+static void AplicaEscrituras(void){
+    unsigned int unidades;
+
+    if(pendientes != 0){
+        unsigned char p = pendientes;
+        pendientes = 0;
+        if(p & PEND_T2CON) ProgramaTimer2();
+        if(p & PEND_T3CON) ProgramaTimer3();
+        if(p & PEND_T1CON) ProgramaTimer1();
+        if(p & PEND_T0CON) ProgramaTimer0(0);
+        if(p & PEND_TMR0)  ProgramaTimer0(1);
+        if(p & PEND_TXREG) EscrituraTXREG();
+        if(p & PEND_PORTB) RevisaCambioPORTB();
+        CalculaProximo();
+    }
+
+    switch((sim_OSCCON.byte >> 4) & 0x07){
+        case 7: unidades = 1;   break;  // 8 MHz
+        case 6: unidades = 2;   break;  // 4 MHz
+        case 5: unidades = 4;   break;  // 2 MHz
+        case 4: unidades = 8;   break;  // 1 MHz
+        case 3: unidades = 16;  break;  // 500 kHz
+        case 2: unidades = 32;  break;  // 250 kHz
+        case 1: unidades = 64;  break;  // 125 kHz
+        default: unidades = 258; break; // INTRC 31 kHz
+    }
+    if(unidades != unidadesCiclo){
+        unidadesCiclo = unidades;
+        CalculaProximo();
+    }
+    // Cambio de IRCF: los timers siguen contando ciclos, ahora de otra duración.
+
+    if((sim_EECON1.byte & B_WR) && eeFin == NUNCA){
+        eeDireccion = sim_EEADR.byte;
+        eeDato      = sim_EEDATA.byte;
+        eeFin       = sim.ahora + SIM_MS(4);
+        CalculaProximo();
+    }
+    // Escritura de un byte: ~4 ms (TWR) sin depender del reloj.
+
+    if(sim_HLVDCON.byte & B_HLVDEN){
+        sim_HLVDCON.byte |= B_IRVST;
+    }
+}
+
+// ------------------------------ HD44780 ------------------------------
+
+static void LCDOcupado(uint64_t medioUs){
+    lcdOcupado = sim.ahora + medioUs;
+}
+
+static void LCDInstruccion(unsigned char rs, unsigned char dato){
+    sim.lcdBytes++;
+    sim.lcdUltimo = sim.ahora;
+    if(sim.ahora < lcdOcupado){
+        sim.lcdErrores++;
+    }
+    // El HD44780 ignora lo que llega mientras ejecuta la instrucción anterior.
+
+    if(rs){
+        if(lcdEnCGRAM){
+            cgram[lcdDireccion & 0x3F] = dato;
+            lcdDireccion = (lcdDireccion + lcdIncremento) & 0x3F;
+        }else{
+            ddram[lcdDireccion & 0x7F] = dato;
+            lcdDireccion = (unsigned char)(lcdDireccion + lcdIncremento);
+            if(lcdDireccion == 0x28) lcdDireccion = 0x40;
+            else if(lcdDireccion == 0x68) lcdDireccion = 0x00;
+            else if(lcdDireccion == 0x3F) lcdDireccion = 0x27;
+            else if(lcdDireccion == 0xFF) lcdDireccion = 0x67;
+        }
+        LCDOcupado(SIM_US(43));
+        return;
+    }
+
+    if(dato & 0x80){
+        lcdDireccion = dato & 0x7F;
+        lcdEnCGRAM   = 0;
+    }else if(dato & 0x40){
+        lcdDireccion = dato & 0x3F;
+        lcdEnCGRAM   = 1;
+    }else if(dato & 0x20){
+        if((dato & 0x10) == 0){
+            lcd4Bits = 1;
+        }
+    }else if(dato & 0x10){
+        if(dato & 0x08){
+            lcdDesplazamiento = (dato & 0x04) ? (lcdDesplazamiento + 39) % 40 : (lcdDesplazamiento + 1) % 40;
+            // lcdDesplazamiento cuenta corrimientos a la izquierda (R/L = 0).
+        }else{
+            lcdDireccion = (unsigned char)(lcdDireccion + ((dato & 0x04) ? 1 : -1));
+        }
+    }else if(dato & 0x08){
+        // Display, cursor y parpadeo: no cambian el contenido.
+    }else if(dato & 0x04){
+        lcdIncremento = (dato & 0x02) ? 1 : -1;
+    }else if(dato & 0x02){
+        lcdDireccion      = 0;
+        lcdEnCGRAM        = 0;
+        lcdDesplazamiento = 0;
+        LCDOcupado(SIM_US(1520));
+        return;
+    }else if(dato & 0x01){
+        memset(ddram, ' ', sizeof ddram);
+        lcdDireccion      = 0;
+        lcdEnCGRAM        = 0;
+        lcdDesplazamiento = 0;
+        lcdIncremento     = 1;
+        LCDOcupado(SIM_US(1520));
+        return;
+    }
+    LCDOcupado(SIM_US(37));
+}
+
+static void LCDPulsoE(void){
+    // Flanco de E: el LCD toma RD4-RD7 (y RS de RA4).
+    unsigned char nibble = sim_LATD.byte >> 4;
+    unsigned char rs     = (sim_LATA.byte >> 4) & 1;
+
+    if(lcd4Bits == 0){
+        if(sim.ahora < lcdOcupado){
+            sim.lcdErrores++;
+        }
+        sim.lcdBytes++;
+        sim.lcdUltimo = sim.ahora;
+        if(nibble == 0x03){
+            LCDOcupado(lcdOcupado == 0 || sim.ahora < SIM_MS(50) ? SIM_US(4100) : SIM_US(100));
+        }else if(nibble == 0x02){
+            lcd4Bits = 1;
+            lcdMitad = 0;
+            LCDOcupado(SIM_US(37));
+        }
+        // En 8 bits solo llegan los nibbles de la inicialización (D0-D3 sin conectar).
+        return;
+    }
+    if(lcdMitad == 0){
+        lcdNibbleAlto = nibble;
+        lcdMitad      = 1;
+        return;
+    }
+    lcdMitad = 0;
+    LCDInstruccion(rs, (unsigned char)((lcdNibbleAlto << 4) | nibble));
+}
+
+unsigned char sim_ddram_visible(unsigned char celda){
+    unsigned char columna = (unsigned char)((celda % 16 + lcdDesplazamiento) % 40);
+
+    return ddram[(celda < 16 ? 0x00 : 0x40) + columna];
+}
+
+void sim_texto_lcd(unsigned char fila, char *texto){
+    for(unsigned char i = 0; i < 16; i++){
+        unsigned char c = sim_ddram_visible(fila * 16 + i);
+        texto[i] = (c < 8) ? '#' : (char)c;
+    }
+    texto[16] = '\0';
+}
+
+unsigned char sim_puerto(unsigned char puerto){
+    switch(puerto){
+        case 'A': return sim_LATA.byte;
+        case 'B': return sim_LATB.byte;
+        case 'D': return sim_LATD.byte;
+        case 'E': return sim_LATE.byte;
+    }
+    return 0;
+}
+
+// ------------------------------ Eventos ------------------------------
+
+static void Captura(volatile sim_sfr8 *ccpcon, volatile unsigned short *ccpr, unsigned char bandera,
+                    volatile sim_sfr8 *pir, unsigned char subida){
+    unsigned char modo = ccpcon->byte & 0x0F;
+
+    if(dormido){
+        return;
+    }
+    // Sin oscilador no hay base de tiempo ni captura (por eso RC1 no despierta al PIC).
+    if((modo == 0x05 && subida) || (modo == 0x04 && !subida)){
+        *ccpr = (unsigned short)ValorTimer3();
+        pir->byte |= bandera;
+    }
+}
+
+static void AplicaEstimulo(const Estimulo *e){
+    switch(e->tipo){
+        case EST_SENSOR:{
+            unsigned char nivel = e->arg & 1;
+            if(((pinesC >> 1) & 1) == nivel){
+                break;
+            }
+            pinesC ^= 0x02;
+            if(nivel){
+                sim.flancosRC1++;
+                if(e->arg & 2){
+                    sim.flancosPieza++;
+                    if(dormido){
+                        sim.piezasDormido++;
+                    }
+                }
+            }
+            Captura(&sim_CCP2CON, &sim_CCPR2, B_CCP2IF, &sim_PIR2, nivel);
+            break;
+        }
+        case EST_PARADA:{
+            unsigned char nivel = e->arg & 1;
+            if(((pinesC >> 2) & 1) == nivel){
+                break;
+            }
+            pinesC ^= 0x04;
+            Captura(&sim_CCP1CON, &sim_CCPR1, B_CCP1IF, &sim_PIR1, nivel);
+            break;
+        }
+        case EST_CARRIL:
+            if(e->arg & 0x08) pinesC |= (unsigned char)(1u << (e->arg & 7));
+            else              pinesC &= (unsigned char)~(1u << (e->arg & 7));
+            break;
+        case EST_TECLA:
+            if(e->arg & 0x10) teclas |= 1u << (e->arg & 0x0F);
+            else              teclas &= ~(1u << (e->arg & 0x0F));
+            RevisaCambioPORTB();
+            break;
+        case EST_CAIDA:
+            if(sim_HLVDCON.byte & B_HLVDEN){
+                sim_PIR2.byte |= B_HLVDIF;
+            }
+            break;
+        case EST_VERIFICA:
+            if(verificacion != 0){
+                verificacion(e->arg);
+            }
+            break;
+        case EST_FIN:
+            longjmp(salida, 1);
+    }
+}
+
+static void ProcesaEventos(void){
+    unsigned int periodo = (unsigned int)sim_PR2.byte + 1;
+
+    while(t2Proximo <= sim.ciclos){
+        t2Anterior = t2Proximo;
+        t2Proximo += (uint64_t)periodo * t2Pre;
+        t2Valor    = 0;
+        t2Desbordes++;
+        if(t2Desbordes >= t2Post){
+            t2Desbordes = 0;
+            sim_PIR1.byte |= B_TMR2IF;
+        }
+    }
+    while(t0Proximo <= sim.ciclos){
+        t0Referencia = t0Proximo;
+        t0Base       = 0;
+        t0Proximo   += (uint64_t)t0Modulo * t0Pre;
+        sim_INTCON.byte |= B_TMR0IF;
+    }
+    while(t3Proximo <= sim.ciclos){
+        t3Referencia = t3Proximo;
+        t3Base       = 0;
+        t3Proximo   += 65536ULL * t3Pre;
+        sim_PIR2.byte |= B_TMR3IF;
+    }
+    if(txDesplazando && txFin <= sim.ciclos){
+        txDesplazando = 0;
+        DecodificaTX(txByte);
+        if(txEspera){
+            txEspera = 0;
+            CargaTSR(sim_TXREG.byte);
+        }else{
+            sim_TXSTA.byte |= B_TRMT;
+        }
+    }
+    if((sim_EECON1.byte & B_WR) && eeFin <= sim.ahora){
+        simEEPROM[eeDireccion] = eeDato;
+        simEscriturasCelda[eeDireccion]++;
+        sim.escriturasEEPROM++;
+        if(simEscriturasCelda[eeDireccion] > sim.maxEscriturasCelda){
+            sim.maxEscriturasCelda = simEscriturasCelda[eeDireccion];
+        }
+        eeFin = NUNCA;
+        sim_EECON1.byte &= (unsigned char)~B_WR;
+        sim_PIR2.byte   |= B_EEIF;
+    }
+    while(proximoEstimulo < totalEstimulos && linea[proximoEstimulo].tiempo <= sim.ahora){
+        const Estimulo *e = &linea[proximoEstimulo++];
+        CalculaProximo();
+        AplicaEstimulo(e);
+    }
+    CalculaProximo();
+}
+
+static void Avanza(uint64_t ciclos){
+    // Los ciclos corren con el oscilador en marcha (CPU o PRI_IDLE).
+    uint64_t tiempo = ciclos * unidadesCiclo;
+
+    sim.ahora  += tiempo;
+    sim.ciclos += ciclos;
+    if(nivelISR != 0)                 sim.tiempoISR     += tiempo;
+    else if(categoria == CAT_ESPERA)  sim.tiempoEspera  += tiempo;
+    else if(categoria == CAT_REPOSO)  sim.tiempoReposo  += tiempo;
+}
+
+// ------------------------------ Interrupciones ------------------------------
+
+static void CorreCiclos(uint64_t ciclos);
+
+static void Interrupciones(void){
+    for(;;){
+        unsigned char intcon = sim_INTCON.byte;
+        unsigned char p1 = sim_PIR1.byte & sim_PIE1.byte;
+        unsigned char p2 = sim_PIR2.byte & sim_PIE2.byte;
+        unsigned char rb = (intcon & B_RBIE) && (intcon & B_RBIF);
+        unsigned char t0 = (intcon & B_TMR0IE) && (intcon & B_TMR0IF);
+        unsigned char alta;
+        unsigned char baja;
+
+        if(sim_RCON.byte & B_IPEN){
+            alta = (p1 & sim_IPR1.byte) || (p2 & sim_IPR2.byte) || (rb && (sim_INTCON2.byte & B_RBIP)) ||
+                   (t0 && (sim_INTCON2.byte & B_TMR0IP));
+            baja = (p1 & (unsigned char)~sim_IPR1.byte) || (p2 & (unsigned char)~sim_IPR2.byte) ||
+                   (rb && !(sim_INTCON2.byte & B_RBIP)) || (t0 && !(sim_INTCON2.byte & B_TMR0IP));
+        }else{
+            alta = ((intcon & B_GIEL) && (p1 || p2)) || rb || t0;
+            baja = 0;
+            // Modo compatible: un solo vector (0x0008) y PEIE para los periféricos.
+        }
+
+        uint64_t entrada = sim.ciclos;
+
+        if(alta && (intcon & B_GIEH) && nivelISR < 2){
+            unsigned char anterior = nivelISR;
+            sim_INTCON.byte &= (unsigned char)~B_GIEH;
+            nivelISR = 2;
+            sim.isrAlta++;
+            CorreCiclos(3);
+            if(ISRParada != 0) ISRParada();
+            else               ISR();
+            CorreCiclos(2);
+            nivelISR = anterior;
+            sim_INTCON.byte |= B_GIEH;
+            // Contexto en los registros sombra: entrada y RETFIE FAST cortos.
+        }else if(baja && (intcon & B_GIEH) && (intcon & B_GIEL) && nivelISR == 0){
+            sim_INTCON.byte &= (unsigned char)~B_GIEL;
+            nivelISR = 1;
+            sim.isrBaja++;
+            CorreCiclos(20);
+            ISR();
+            CorreCiclos(20);
+            nivelISR = 0;
+            sim_INTCON.byte |= B_GIEL;
+            // XC8 guarda y recupera el contexto por software en la de baja prioridad.
+        }else{
+            return;
+        }
+        if(sim.ciclos - entrada > sim.isrMaxCiclos){
+            sim.isrMaxCiclos = sim.ciclos - entrada;
+        }
+    }
+}
+
+static void CorreCiclos(uint64_t ciclos){
+    // La CPU ejecuta 'ciclos' ciclos en el contexto actual; en cada evento pueden
+    // entrar interrupciones, que agregan su propio tiempo.
+    while(ciclos != 0){
+        if(sim.ciclos + ciclos < proximoCiclo){
+            Avanza(ciclos);
+            break;
+        }
+        uint64_t hasta = proximoCiclo > sim.ciclos ? proximoCiclo - sim.ciclos : 0;
+        Avanza(hasta);
+        ciclos -= hasta;
+        ProcesaEventos();
+        Interrupciones();
+    }
+    Interrupciones();
+}
+
+// ------------------------------ Enganches del firmware ------------------------------
+
+volatile sim_sfr8 *sim_acceso8(volatile sim_sfr8 *registro){
+    AplicaEscrituras();
+    if(nivelISR == 0){
+        accesosMain++;
+    }
+    CorreCiclos(1 + (jitter ? Azar() % jitter : 0));
+
+    if(registro == &sim_PORTB){
+        columnasLeidas    = Columnas();
+        sim_PORTB.byte    = (unsigned char)(columnasLeidas | (sim_LATB.byte & 0x0F));
+        // Leer PORTB termina la condición de cambio; RBIF la limpia el firmware.
+    }else if(registro == &sim_PORTC){
+        sim_PORTC.byte = pinesC;
+    }else if(registro == &sim_EEDATA){
+        if(sim_EECON1.byte & B_RD){
+            sim_EEDATA.byte  = simEEPROM[sim_EEADR.byte];
+            sim_EECON1.byte &= (unsigned char)~B_RD;
+        }
+    }else if(registro == &sim_TXSTA){
+        sim_TXSTA.byte = (unsigned char)((sim_TXSTA.byte & ~B_TRMT) | (txDesplazando ? 0 : B_TRMT));
+        // TRMT es de solo lectura: una escritura de TXSTA no lo cambia.
+    }else if(registro == &sim_TXREG){
+        pendientes |= PEND_TXREG;
+    }else if(registro == &sim_T2CON || registro == &sim_PR2){
+        pendientes |= PEND_T2CON;
+    }else if(registro == &sim_T3CON){
+        pendientes |= PEND_T3CON;
+    }else if(registro == &sim_T1CON){
+        pendientes |= PEND_T1CON;
+    }else if(registro == &sim_T0CON){
+        pendientes |= PEND_T0CON;
+    }else if(registro == &sim_LATB || registro == &sim_TRISB){
+        pendientes |= PEND_PORTB;
+    }
+    return registro;
+}
+
+volatile unsigned short *sim_acceso16(volatile unsigned short *registro){
+    AplicaEscrituras();
+    if(nivelISR == 0){
+        accesosMain++;
+    }
+    CorreCiclos(2 + (jitter ? Azar() % jitter : 0));
+    // Lectura de 16 bits con RD16: dos instrucciones.
+
+    if(registro == &sim_TMR0){
+        sim_TMR0    = (unsigned short)ValorTimer0();
+        pendientes |= PEND_TMR0;
+        // El firmware solo escribe TMR0 (la recarga): el acceso se toma como escritura.
+    }else if(registro == &sim_TMR3){
+        sim_TMR3 = (unsigned short)ValorTimer3();
+    }else if(registro == &sim_TMR1){
+        sim_TMR1 = (unsigned short)ValorTimer1();
+    }
+    return registro;
+}
+
+void sim_vuelta(void){
+    AplicaEscrituras();
+    if(nivelISR == 0 && accesosMain == accesosUltimaVuelta){
+        categoria = CAT_ESPERA;
+    }
+    // Una vuelta sin acceder a registros es una espera activa (while(cola != ...){}).
+    accesosUltimaVuelta = accesosMain;
+    CorreCiclos(3);
+    categoria = CAT_CPU;
+}
+
+void sim_retardo(unsigned long ciclos){
+    AplicaEscrituras();
+    if(nivelISR == 0){
+        categoria = CAT_ESPERA;
+    }
+    CorreCiclos(ciclos);
+    categoria = CAT_CPU;
+}
+
+void sim_retardo_us(unsigned long us){
+    AplicaEscrituras();
+    if((sim_LATA.byte & 0x20) && (sim_TRISA.byte & 0x20) == 0){
+        LCDPulsoE();
+    }
+    // HabilitaLCD(): E = 1, __delay_us(1), E = 0.
+    sim_retardo((us * 2 + unidadesCiclo - 1) / unidadesCiclo);
+}
+
+static unsigned char Despierta(void){
+    // Cualquier interrupción habilitada despierta al PIC, con GIE en 0 o en 1.
+    return (sim_PIR1.byte & sim_PIE1.byte) || (sim_PIR2.byte & sim_PIE2.byte) ||
+           ((sim_INTCON.byte & B_RBIE) && (sim_INTCON.byte & B_RBIF)) ||
+           ((sim_INTCON.byte & B_TMR0IE) && (sim_INTCON.byte & B_TMR0IF));
+}
+
+void sim_duerme(void){
+    AplicaEscrituras();
+
+    if(sim_OSCCON.byte & B_IDLEN){
+        // PRI_IDLE: se detiene la CPU; los periféricos siguen con el oscilador.
+        categoria = CAT_REPOSO;
+        while(!Despierta()){
+            uint64_t hasta = proximoCiclo > sim.ciclos ? proximoCiclo - sim.ciclos : 0;
+            Avanza(hasta);
+            ProcesaEventos();
+        }
+        categoria = CAT_CPU;
+        return;
+    }
+
+    // Sleep: sin oscilador. Solo avanza el tiempo real hasta un estímulo que despierte.
+    sim.vecesDormido++;
+    dormido = 1;
+    while(!Despierta()){
+        uint64_t tiempo = NUNCA;
+        if(proximoEstimulo < totalEstimulos) tiempo = linea[proximoEstimulo].tiempo;
+        if(sim_EECON1.byte & B_WR)           tiempo = Min(tiempo, eeFin);
+        if(tiempo > sim.ahora){
+            sim.tiempoDormido += tiempo - sim.ahora;
+            sim.ahora          = tiempo;
+        }
+        ProcesaEventos();
+    }
+    dormido = 0;
+    sim.despertares++;
+}
+
+void sim_eeprom_datos(unsigned char bloque, const unsigned char *datos){
+    memcpy(&simEEPROM[bloque * 8], datos, 8);
+}
+
+// ------------------------------ Control ------------------------------
+
+void sim_inicia(const Estimulo *estimulos, unsigned int total, unsigned int jit, unsigned int semilla){
+    linea           = estimulos;
+    totalEstimulos  = total;
+    proximoEstimulo = 0;
+    jitter          = jit;
+    azar            = semilla ? semilla : 1;
+
+    // Valores de reset de la hoja de datos (los que el firmware usa)
+    sim_TRISA.byte   = 0xFF;
+    sim_TRISB.byte   = 0xFF;
+    sim_TRISC.byte   = 0xFF;
+    sim_TRISD.byte   = 0xFF;
+    sim_TRISE.byte   = 0x07;
+    sim_INTCON2.byte = 0xF5;
+    sim_T0CON.byte   = 0xFF;
+    sim_IPR1.byte    = 0xFF;
+    sim_IPR2.byte    = 0xFF;
+    sim_PIR1.byte    = B_TXIF;
+    sim_TXSTA.byte   = B_TRMT;
+    sim_OSCCON.byte  = 0x44;
+    sim_PR2.byte     = 0xFF;
+    sim_HLVDCON.byte = 0x05;
+
+    t0Proximo = NUNCA;
+    t2Proximo = NUNCA;
+    t3Proximo = NUNCA;
+    eeFin     = NUNCA;
+    memset(ddram, ' ', sizeof ddram);
+    LCDOcupado(SIM_MS(40));
+    // El HD44780 necesita 40 ms desde el encendido antes de la primera instrucción.
+
+    CalculaProximo();
+}
+
+void sim_corre(void (*programa)(void), void (*verifica)(unsigned int indice)){
+    verificacion = verifica;
+    if(setjmp(salida) == 0){
+        programa();
+    }
+}
@@ -0,0 +1,85 @@
+// ============================================================================
+// sim.h - PIC18F4550 virtual para correr Lab4.c en el PC
+// ============================================================================
+// El reloj virtual cuenta en medios microsegundos (un ciclo de instrucción a
+// 8 MHz). Los periféricos que usa el firmware avanzan con él:
+//   Timer0 a Timer3 (con sus banderas), CCP1/CCP2 en captura,
+//   la EUSART (bytes por trama decodificados), la EEPROM de datos (4 ms por
+//   byte), el teclado matricial en PORTB, los sensores en PORTC, el HLVD y un
+//   HD44780 en 4 bits que recibe cada pulso de E.
+// Lo que corre el firmware entre dos accesos a registros no gasta tiempo; cada
+// acceso cuesta un ciclo y cada vuelta de un while tres, así que las cuentas
+// de ciclos sirven para comparar escenarios y versiones (make banco), no como
+// ciclos de instrucción reales de una ruta (make banco_pic, en gpsim).
+// ============================================================================
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_US(us)          ((uint64_t)(us) * 2)
+#define SIM_MS(ms)          ((uint64_t)(ms) * 2000)
+// Tiempo virtual en medios microsegundos.
+
+// Estímulos (los pone el escenario en la línea de tiempo)
+#define EST_SENSOR          0   // arg = nivel de RC1
+#define EST_PARADA          1   // arg = nivel de RC2
+#define EST_CARRIL          2   // arg = bit de PORTC (0-7) | nivel << 3
+#define EST_TECLA           3   // arg = bit del teclado (0-15) | presionada << 4
+#define EST_CAIDA           4   // VDD cae bajo el umbral del HLVD
+#define EST_VERIFICA        5   // arg = índice de la verificación del escenario
+#define EST_FIN             6   // termina la simulación
+
+typedef struct{
+    uint64_t tiempo;
+    unsigned char tipo;
+    unsigned short arg;
+} Estimulo;
+
+// Estadísticas que el escenario puede verificar
+typedef struct{
+    uint64_t ahora;             // tiempo virtual
+    uint64_t ciclos;            // ciclos de instrucción con reloj (no cuentan en Sleep)
+    uint64_t tiempoISR;         // dentro de ISR() o ISRParada()
+    uint64_t isrMaxCiclos;      // la entrada más larga a un vector, en ciclos (con la alta anidada)
+    uint64_t tiempoReposo;      // Sleep con IDLEN = 1
+    uint64_t tiempoDormido;     // Sleep con IDLEN = 0 (relojes detenidos)
+    uint64_t tiempoEspera;      // esperas activas de main(): __delay y whiles vacíos
+    unsigned long flancosPieza; // subidas de RC1 que son piezas (sin rebotes)
+    unsigned long flancosRC1;   // todas las subidas de RC1
+    unsigned long piezasDormido;// subidas de RC1 con el reloj detenido (no capturadas)
+    unsigned long isrBaja;
+    unsigned long isrAlta;
+    unsigned long bytesTX;
+    unsigned long tramas[16];   // tramas válidas por tipo
+    unsigned long tramasMalas;  // CRC o sincronismo incorrectos
+    unsigned long escriturasEEPROM;
+    unsigned long maxEscriturasCelda;
+    unsigned long lcdBytes;     // bytes completos recibidos por el HD44780
+    unsigned long lcdErrores;   // bytes que llegaron con el LCD ocupado
+    uint64_t lcdUltimo;         // tiempo del último byte (o nibble de inicio) recibido
+    unsigned long vecesDormido;
+    unsigned long despertares;
+} Estadisticas;
+
+extern Estadisticas sim;
+
+extern unsigned char simEEPROM[256];
+extern unsigned long simEscriturasCelda[256];
+
+void sim_inicia(const Estimulo *linea, unsigned int total, unsigned int jitter, unsigned int semilla);
+// Prepara el PIC virtual (estado de reset) con la línea de tiempo ya ordenada.
+// jitter > 0: cada acceso cuesta además 0..jitter-1 ciclos al azar, para que las
+// interrupciones caigan en puntos distintos del firmware.
+void sim_corre(void (*programa)(void), void (*verifica)(unsigned int indice));
+// Corre el programa hasta EST_FIN. Las verificaciones se llaman en su tiempo.
+
+void sim_texto_lcd(unsigned char linea, char *texto);
+// 16 caracteres visibles de la línea 0 o 1 (los códigos de CGRAM 0-7 salen como '#').
+unsigned char sim_ddram_visible(unsigned char celda);
+// Código en la celda visible 0-31 (0-15 primera línea).
+unsigned char sim_puerto(unsigned char puerto);
+// Valor de los pines de salida: 'A', 'B', 'D' o 'E' (LAT).
+
+#endif
@@ -0,0 +1,50 @@
+// ============================================================================
+// sim_registros.h - Registros del PIC virtual (los comparten xc.h y sim.c)
+// ============================================================================
+
+#ifndef SIM_REGISTROS_H
+#define SIM_REGISTROS_H
+
+typedef union{
+    unsigned char byte;
+    struct{
+        unsigned char b0:1, b1:1, b2:1, b3:1, b4:1, b5:1, b6:1, b7:1;
+    } bits;
+} sim_sfr8;
+
+volatile sim_sfr8 *sim_acceso8(volatile sim_sfr8 *registro);
+volatile unsigned short *sim_acceso16(volatile unsigned short *registro);
+// Un ciclo de instrucción y, si corresponde, una interrupción antes del acceso.
+
+void sim_vuelta(void);
+// Cada vuelta de un while del firmware (ver la redefinición de while al final).
+void sim_retardo(unsigned long ciclos);
+// __delay_ms(): el tiempo pasa y las interrupciones siguen entrando.
+void sim_retardo_us(unsigned long us);
+// __delay_us(): además el modelo del LCD toma el dato si E está en 1.
+void sim_duerme(void);
+// Sleep(): PRI_IDLE o suspensión completa según IDLEN.
+void sim_eeprom_datos(unsigned char bloque, const unsigned char *datos);
+// __EEPROM_DATA(): 8 bytes del contenido inicial de la EEPROM.
+
+#define SIM_DEFINE_SFR8(r)   extern volatile sim_sfr8 sim_##r;
+#define SIM_DEFINE_SFR16(r)  extern volatile unsigned short sim_##r;
+
+SIM_DEFINE_SFR8(ADCON1)   SIM_DEFINE_SFR8(BAUDCON)  SIM_DEFINE_SFR8(CCP1CON)
+SIM_DEFINE_SFR8(CCP2CON)  SIM_DEFINE_SFR8(EEADR)    SIM_DEFINE_SFR8(EECON1)
+SIM_DEFINE_SFR8(EECON2)   SIM_DEFINE_SFR8(EEDATA)   SIM_DEFINE_SFR8(HLVDCON)
+SIM_DEFINE_SFR8(INTCON)   SIM_DEFINE_SFR8(INTCON2)  SIM_DEFINE_SFR8(IPR1)
+SIM_DEFINE_SFR8(IPR2)     SIM_DEFINE_SFR8(LATA)     SIM_DEFINE_SFR8(LATB)
+SIM_DEFINE_SFR8(LATD)     SIM_DEFINE_SFR8(LATE)     SIM_DEFINE_SFR8(OSCCON)
+SIM_DEFINE_SFR8(PIE1)     SIM_DEFINE_SFR8(PIE2)     SIM_DEFINE_SFR8(PIR1)
+SIM_DEFINE_SFR8(PIR2)     SIM_DEFINE_SFR8(PORTB)    SIM_DEFINE_SFR8(PORTC)
+SIM_DEFINE_SFR8(PR2)      SIM_DEFINE_SFR8(RCON)     SIM_DEFINE_SFR8(RCSTA)
+SIM_DEFINE_SFR8(SPBRG)    SIM_DEFINE_SFR8(SPBRGH)   SIM_DEFINE_SFR8(T0CON)
+SIM_DEFINE_SFR8(T1CON)    SIM_DEFINE_SFR8(T2CON)    SIM_DEFINE_SFR8(T3CON)
+SIM_DEFINE_SFR8(TRISA)    SIM_DEFINE_SFR8(TRISB)    SIM_DEFINE_SFR8(TRISC)
+SIM_DEFINE_SFR8(TRISD)    SIM_DEFINE_SFR8(TRISE)    SIM_DEFINE_SFR8(TXREG)
+SIM_DEFINE_SFR8(TXSTA)
+SIM_DEFINE_SFR16(CCPR1)   SIM_DEFINE_SFR16(CCPR2)   SIM_DEFINE_SFR16(TMR0)
+SIM_DEFINE_SFR16(TMR1)    SIM_DEFINE_SFR16(TMR3)
+
+#endif
@@ -0,0 +1,158 @@
+// ============================================================================
+// xc.h - Registros del PIC18F4550 para compilar Lab4.c en el PC
+// ============================================================================
+// Reemplaza al xc.h del compilador XC8 solo en la simulación de tests/host
+// (el Makefile pone este directorio primero en la ruta de includes).
+//
+// Cada registro es un byte en sim.c y cada bit un campo del mismo byte, con
+// la misma posición que en la hoja de datos, así que escribir LATA o LATA1
+// toca el mismo registro. Todo acceso pasa por sim_acceso8()/sim_acceso16():
+// cuesta un ciclo de instrucción del reloj virtual y, antes de devolver el
+// registro, puede entrar ISR() o ISRParada() si hay una interrupción
+// habilitada pendiente (igual que en el PIC, entre dos instrucciones).
+//
+// El PIC tiene int de 16 bits y el firmware cuenta con que los unsigned int
+// dan la vuelta en 65535: al final del archivo int pasa a ser short.
+// ============================================================================
+
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+#include "sim_registros.h"
+
+#define SIM_R8(r)       (sim_acceso8(&sim_##r)->byte)
+#define SIM_BIT(r, b)   (sim_acceso8(&sim_##r)->bits.b)
+#define SIM_R16(r)      (*sim_acceso16(&sim_##r))
+
+// ------------------------------ Registros ------------------------------
+
+#define ADCON1   SIM_R8(ADCON1)
+#define BAUDCON  SIM_R8(BAUDCON)
+#define CCP1CON  SIM_R8(CCP1CON)
+#define CCP2CON  SIM_R8(CCP2CON)
+#define EEADR    SIM_R8(EEADR)
+#define EECON1   SIM_R8(EECON1)
+#define EECON2   SIM_R8(EECON2)
+#define EEDATA   SIM_R8(EEDATA)
+#define HLVDCON  SIM_R8(HLVDCON)
+#define INTCON   SIM_R8(INTCON)
+#define INTCON2  SIM_R8(INTCON2)
+#define IPR1     SIM_R8(IPR1)
+#define IPR2     SIM_R8(IPR2)
+#define LATA     SIM_R8(LATA)
+#define LATB     SIM_R8(LATB)
+#define LATD     SIM_R8(LATD)
+#define LATE     SIM_R8(LATE)
+#define OSCCON   SIM_R8(OSCCON)
+#define PIE1     SIM_R8(PIE1)
+#define PIE2     SIM_R8(PIE2)
+#define PIR1     SIM_R8(PIR1)
+#define PIR2     SIM_R8(PIR2)
+#define PORTB    SIM_R8(PORTB)
+#define PORTC    SIM_R8(PORTC)
+#define PR2      SIM_R8(PR2)
+#define RCON     SIM_R8(RCON)
+#define RCSTA    SIM_R8(RCSTA)
+#define SPBRG    SIM_R8(SPBRG)
+#define SPBRGH   SIM_R8(SPBRGH)
+#define T0CON    SIM_R8(T0CON)
+#define T1CON    SIM_R8(T1CON)
+#define T2CON    SIM_R8(T2CON)
+#define T3CON    SIM_R8(T3CON)
+#define TRISA    SIM_R8(TRISA)
+#define TRISB    SIM_R8(TRISB)
+#define TRISC    SIM_R8(TRISC)
+#define TRISD    SIM_R8(TRISD)
+#define TRISE    SIM_R8(TRISE)
+#define TXREG    SIM_R8(TXREG)
+#define TXSTA    SIM_R8(TXSTA)
+#define CCPR1    SIM_R16(CCPR1)
+#define CCPR2    SIM_R16(CCPR2)
+#define TMR0     SIM_R16(TMR0)
+#define TMR1     SIM_R16(TMR1)
+#define TMR3     SIM_R16(TMR3)
+
+// ------------------------------ Bits ------------------------------
+
+#define GIE      SIM_BIT(INTCON, b7)
+#define GIEH     SIM_BIT(INTCON, b7)
+#define PEIE     SIM_BIT(INTCON, b6)
+#define GIEL     SIM_BIT(INTCON, b6)
+#define TMR0IE   SIM_BIT(INTCON, b5)
+#define RBIE     SIM_BIT(INTCON, b3)
+#define TMR0IF   SIM_BIT(INTCON, b2)
+#define RBIF     SIM_BIT(INTCON, b0)
+#define RBPU     SIM_BIT(INTCON2, b7)
+#define TMR0IP   SIM_BIT(INTCON2, b2)
+#define RBIP     SIM_BIT(INTCON2, b0)
+#define TMR0ON   SIM_BIT(T0CON, b7)
+#define TXIF     SIM_BIT(PIR1, b4)
+#define CCP1IF   SIM_BIT(PIR1, b2)
+#define TMR2IF   SIM_BIT(PIR1, b1)
+#define TXIE     SIM_BIT(PIE1, b4)
+#define CCP1IE   SIM_BIT(PIE1, b2)
+#define TMR2IE   SIM_BIT(PIE1, b1)
+#define TXIP     SIM_BIT(IPR1, b4)
+#define CCP1IP   SIM_BIT(IPR1, b2)
+#define TMR2IP   SIM_BIT(IPR1, b1)
+#define EEIF     SIM_BIT(PIR2, b4)
+#define HLVDIF   SIM_BIT(PIR2, b2)
+#define TMR3IF   SIM_BIT(PIR2, b1)
+#define CCP2IF   SIM_BIT(PIR2, b0)
+#define EEIE     SIM_BIT(PIE2, b4)
+#define HLVDIE   SIM_BIT(PIE2, b2)
+#define TMR3IE   SIM_BIT(PIE2, b1)
+#define CCP2IE   SIM_BIT(PIE2, b0)
+#define IPEN     SIM_BIT(RCON, b7)
+#define IDLEN    SIM_BIT(OSCCON, b7)
+#define IOFS     SIM_BIT(OSCCON, b2)
+#define EEPGD    SIM_BIT(EECON1, b7)
+#define CFGS     SIM_BIT(EECON1, b6)
+#define WREN     SIM_BIT(EECON1, b2)
+#define WR       SIM_BIT(EECON1, b1)
+#define RD       SIM_BIT(EECON1, b0)
+#define TRMT     SIM_BIT(TXSTA, b1)
+#define IRVST    SIM_BIT(HLVDCON, b5)
+#define LATA1    SIM_BIT(LATA, b1)
+#define LATA2    SIM_BIT(LATA, b2)
+#define LATA3    SIM_BIT(LATA, b3)
+#define LATA4    SIM_BIT(LATA, b4)
+#define LATA5    SIM_BIT(LATA, b5)
+#define TRISA1   SIM_BIT(TRISA, b1)
+#define TRISA2   SIM_BIT(TRISA, b2)
+#define TRISA3   SIM_BIT(TRISA, b3)
+#define TRISA4   SIM_BIT(TRISA, b4)
+#define TRISA5   SIM_BIT(TRISA, b5)
+#define TRISC1   SIM_BIT(TRISC, b1)
+#define TRISC2   SIM_BIT(TRISC, b2)
+#define TRISC6   SIM_BIT(TRISC, b6)
+#define TRISC7   SIM_BIT(TRISC, b7)
+
+// ------------------------------ Compilador ------------------------------
+
+#define NOP()              sim_retardo(1)
+#define Sleep()            sim_duerme()
+#define __delay_ms(x)      sim_retardo((unsigned long)(x) * (_XTAL_FREQ / 4000UL))
+#define __delay_us(x)      sim_retardo_us(x)
+#define __interrupt(x)
+
+#define __EEPROM_DATA(a, b, c, d, e, f, g, h)  SIM_EEPROM_DATA(__COUNTER__, a, b, c, d, e, f, g, h)
+#define SIM_EEPROM_DATA(n, ...)                SIM_EEPROM_BLOQUE(n, __VA_ARGS__)
+#define SIM_EEPROM_BLOQUE(n, a, b, c, d, e, f, g, h)                                  \
+    static void __attribute__((constructor)) sim_eeprom_bloque_##n(void){             \
+        static const unsigned char datos[8] = {a, b, c, d, e, f, g, h};               \
+        sim_eeprom_datos(n, datos);                                                   \
+    }                                                                                 \
+    extern int sim_eeprom_bloque_fin_##n
+// El programador escribe la EEPROM junto con la flash: aquí cada bloque se copia
+// antes de main(). __COUNTER__ numera los bloques en el orden del archivo.
+
+#define while(condicion)   while(sim_vuelta(), (condicion))
+// Las esperas del firmware (while(TRMT == 0){}, while(cola != ...){}) no tocan
+// registros en cada vuelta: así cada vuelta también cuesta tiempo virtual y deja
+// entrar a la ISR que las termina.
+
+#define int short
+// int de 16 bits, como en XC8 (los long quedan más anchos, sin efecto en el firmware).
+
+#endif
@@ -0,0 +1,105 @@
+// ============================================================================
+// DecodificaTelemetria.c - Convierte a CSV la telemetría de Lab4 (EUSART)
+// ============================================================================
+// Programa para el PC (no para el PIC). Lee los bytes que envía el PIC por
+// RC6 a 9600 baudios, desde un archivo capturado o directamente desde un
+// puerto serie / pty del simulador, y escribe una línea CSV por trama válida.
+//
+// Compilar:  gcc -O2 -o DecodificaTelemetria DecodificaTelemetria.c
+// Usar:      ./DecodificaTelemetria captura.bin > telemetria.csv
+//            ./DecodificaTelemetria /dev/ttyUSB0 > telemetria.csv
+//            ./DecodificaTelemetria < captura.bin
+// (el puerto serie debe estar configurado antes, por ejemplo con
+//  stty -F /dev/ttyUSB0 9600 raw)
+//
+// Formato de trama (ver TELEMETRÍA en Lab4.c):
+//   0xA5, tipo, a (16 bits, byte bajo primero), b (16 bits), CRC-8
+// El CRC-8 usa el polinomio 0x07 con valor inicial 0 sobre tipo, a y b.
+// Si el CRC no coincide se descarta solo el byte de sincronismo y se vuelve a
+// buscar 0xA5 desde el byte siguiente; al final se informa por stderr.
+// ============================================================================
+
+#include <stdio.h>
+
+#define TAM_TRAMA          7
+#define TRAMA_SINCRONISMO  0xA5
+
+static const char *NombreTipo(unsigned char tipo){
+    switch(tipo){
+        case 0x01: return "pieza";
+        case 0x02: return "inicio_lote";
+        case 0x03: return "lote_cumplido";
+        case 0x04: return "tecla";
+        case 0x05: return "energia";
+        case 0x06: return "emergencia";
+        case 0x07: return "perdidas";
+        case 0x08: return "traza";
+        default:   return "desconocido";
+    }
+}
+
+static unsigned char Crc8(const unsigned char *datos, int n){
+    unsigned char crc = 0;
+
+    for(int i = 0; i < n; i++){
+        crc ^= datos[i];
+        for(int j = 0; j < 8; j++){
+            if(crc & 0x80)
+                crc = (unsigned char)((crc << 1) ^ 0x07);
+            else
+                crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+int main(int argc, char *argv[]){
+    FILE *entrada = stdin;
+    unsigned char trama[TAM_TRAMA];
+    int llenos = 0;
+    int c;
+    unsigned long validas = 0;
+    unsigned long errores = 0;
+
+    if(argc > 1){
+        entrada = fopen(argv[1], "rb");
+        if(entrada == NULL){
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    printf("tipo,codigo,a,b\n");
+
+    while((c = fgetc(entrada)) != EOF){
+        if(llenos == 0 && c != TRAMA_SINCRONISMO)
+            continue;
+        // Busca el inicio de trama.
+
+        trama[llenos++] = (unsigned char)c;
+        if(llenos < TAM_TRAMA)
+            continue;
+
+        if(Crc8(&trama[1], TAM_TRAMA - 2) == trama[TAM_TRAMA - 1]){
+            printf("%s,%u,%u,%u\n", NombreTipo(trama[1]), trama[1],
+                   trama[2] | (trama[3] << 8), trama[4] | (trama[5] << 8));
+            fflush(stdout);
+            validas++;
+            llenos = 0;
+        }else{
+            // Trama inválida: se busca otro 0xA5 entre los bytes ya leídos.
+            int i;
+
+            errores++;
+            for(i = 1; i < TAM_TRAMA && trama[i] != TRAMA_SINCRONISMO; i++){}
+            llenos = TAM_TRAMA - i;
+            for(int j = 0; j < llenos; j++)
+                trama[j] = trama[i + j];
+        }
+    }
+
+    fprintf(stderr, "%lu tramas validas, %lu con error de CRC\n", validas, errores);
+    if(entrada != stdin)
+        fclose(entrada);
+    return 0;
+}
@@ -0,0 +1,107 @@
+// ============================================================================
+// TrazaAVCD.c - Convierte la traza de eventos de Lab4 a VCD (GTKWave)
+// ============================================================================
+// Programa para el PC (no para el PIC). Lee el CSV de DecodificaTelemetria
+// y escribe un archivo VCD con una señal por ruta del firmware: 1 mientras
+// la ruta está en ejecución y 0 fuera de ella. Las líneas que no son
+// "traza" se ignoran, así que se puede pasar la telemetría completa.
+//
+// Compilar:  gcc -O2 -o TrazaAVCD TrazaAVCD.c
+// Usar:      ./DecodificaTelemetria captura.bin | ./TrazaAVCD > traza.vcd
+//            ./TrazaAVCD telemetria.csv > traza.vcd
+//            gtkwave traza.vcd
+// En el simulador de MPLAB basta con enviar la salida de la UART a un
+// archivo (UART1 IO, salida a archivo) y pasarla por DecodificaTelemetria.
+// También se aceptan líneas "traza,8,evento,tmr3" escritas a mano a partir
+// de trazaEvento[] y trazaTiempo[] leídos con el depurador.
+//
+// Firmware: compilar Lab4.c con TRAZA_EVENTOS y mantener LUZ presionada 1 s.
+//
+// Cada evento trae (ver TRAZA en Lab4.c):
+//   evento: bits 0-5 = MED_*, bit 6 = perfil rápido, bit 7 = salida
+//   tiempo: TMR3 (1:8) -> 32 us por cuenta en el perfil lento, 4 us en el rápido
+// TMR3 da la vuelta cada 65536 cuentas; como la ISR de Timer2 entra cada
+// 1 ms, dos eventos seguidos nunca están a más de una vuelta y basta con
+// sumar 65536 cuando el tiempo retrocede. La excepción es ENERGIA_DORMIDO
+// (Timer2 detenido): ese tramo aparece más corto de lo que fue.
+// ============================================================================
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRAZA_SALE    0x80
+#define TRAZA_RAPIDO  0x40
+#define TRAZA_ID      0x3F
+
+static const char *nombres[] = {
+    "isr",              // MED_ISR
+    "envia_dato",       // MED_ENVIA_DATO
+    "escribe_n8",       // MED_ESCRIBE_N8
+    "mensaje",          // MED_MENSAJE
+    "refresca",         // MED_REFRESCA
+    "config_pregunta",  // MED_CONFIG_PREGUNTA
+    "ciclo_principal",  // MED_CICLO_PRINCIPAL
+    "suma_piezas",      // MED_SUMA_PIEZAS
+    "retardo",          // MED_RETARDO
+    "carriles",         // MED_CARRILES
+};
+#define TOTAL_RUTAS  (int)(sizeof(nombres) / sizeof(nombres[0]))
+
+int main(int argc, char *argv[]){
+    FILE *entrada = stdin;
+    char linea[128];
+    unsigned int codigo, evento, tiempo;
+    unsigned int tiempoAnterior = 0;
+    unsigned long long us = 0;
+    unsigned long long usEscrito = 0;
+    int primero = 1;
+    unsigned long eventos = 0;
+
+    if(argc > 1){
+        entrada = fopen(argv[1], "r");
+        if(entrada == NULL){
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    printf("$timescale 1us $end\n");
+    printf("$scope module lab4 $end\n");
+    for(int i = 0; i < TOTAL_RUTAS; i++)
+        printf("$var wire 1 %c %s $end\n", '!' + i, nombres[i]);
+    printf("$upscope $end\n$enddefinitions $end\n");
+    printf("#0\n$dumpvars\n");
+    for(int i = 0; i < TOTAL_RUTAS; i++)
+        printf("0%c\n", '!' + i);
+    printf("$end\n");
+
+    while(fgets(linea, sizeof(linea), entrada) != NULL){
+        if(strncmp(linea, "traza,", 6) != 0)
+            continue;
+        if(sscanf(linea + 6, "%u,%u,%u", &codigo, &evento, &tiempo) != 3)
+            continue;
+        if((int)(evento & TRAZA_ID) >= TOTAL_RUTAS)
+            continue;
+
+        if(!primero){
+            unsigned long cuentas = (tiempo - tiempoAnterior) & 0xFFFF;
+            // Con aritmética de 16 bits la vuelta de TMR3 se resuelve sola.
+
+            us += cuentas * ((evento & TRAZA_RAPIDO) ? 4 : 32);
+        }
+        primero = 0;
+        tiempoAnterior = tiempo;
+
+        if(us != usEscrito){
+            printf("#%llu\n", us);
+            usEscrito = us;
+        }
+        printf("%c%c\n", (evento & TRAZA_SALE) ? '0' : '1', '!' + (int)(evento & TRAZA_ID));
+        eventos++;
+    }
+
+    fprintf(stderr, "%lu eventos, %llu us\n", eventos, us);
+    if(entrada != stdin)
+        fclose(entrada);
+    return 0;
+}